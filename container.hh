@@ -1,7 +1,11 @@
 #pragma once
 
 #include <stack>
+#include <atomic>
+#include <unordered_map>
 #include "contextual.hh"
+#include "observer.hh"
+#include "parallel.hh"
 
 //=================================
 //
@@ -41,7 +45,7 @@ public:
 		@return a resource manager for `rid`
 		@throws std::out_of_range if there is no resource manager (the resource is undeclared)
 		*/
-	inline auto at(const resourceid& rid) { return rms.at(rid); }
+	inline auto at(const resourceid& rid) { return lookup(rid); }
 
 	/**
 		Return a resource manager for a resource
@@ -52,7 +56,7 @@ public:
 	template <typename Resource>
 	inline resource_manager<Resource>* get_declared(const Resource& r) {
 		try {
-			return static_cast<resource_manager<Resource>*>(rms.at(r));
+			return static_cast<resource_manager<Resource>*>(lookup(r));
 		} catch(std::out_of_range) {
 			return nullptr;
 		}
@@ -69,24 +73,233 @@ public:
 	template <typename Resource>
 	inline resource_manager<Resource>* get(const Resource& r) {
 		try {
-			return static_cast<resource_manager<Resource>*>(rms.at(r));
+			return static_cast<resource_manager<Resource>*>(lookup(r));
 		} catch(std::out_of_range) {
 			auto rm = new resource_manager<Resource>(r);
 			bool succ [[maybe_unused]];
 			std::tie(std::ignore, succ) = rms.emplace(r, rm);
 			assert(succ); // since we just failed the lookup!
+			decl_log.push_back(r);
+			n_declared.store(rms.size() - alias_ids.size(), std::memory_order_relaxed);
 			return rm;
 		}
 	}
 
+	/**
+		Declare a resource as an alias of another resource.
+
+		@tparam Resource the resource type of `a` and `target`
+		@param a the alias
+		@param target the resource aliased by `a`, which is declared by this call
+		@return the resource manager of `target`
+		@throws config_error if `a` is already declared (possibly as an alias),
+		        or if `target` is `a`, or resolves to it
+
+		After this call, `a` is mapped to the resource manager of `target`
+		(or of the target of `target`, if it is an alias itself), and it
+		shares the instances of `target`, since instances are stored under
+		the id of their resource manager.
+	  */
+	template <typename Resource>
+	resource_manager<Resource>* alias(const Resource& a, const Resource& target) {
+		resourceid aid(a);
+		load_module(aid);
+		if(rms.find(aid)!=rms.end())
+			throw config_error(u::str_builder() << "Cannot declare " << aid
+				<< " as an alias of " << resourceid(target) << ", it is already declared");
+		resourceid tid(target);
+		if(tid==aid)
+			throw config_error(u::str_builder() << "Cannot declare " << aid
+				<< " as an alias of itself");
+		resource_manager<Resource>* rm = get(target);
+		if(rms.find(aid)!=rms.end())  // e.g., by the module of target
+			throw config_error(u::str_builder() << "Cannot declare " << aid
+				<< " as an alias of " << tid << ", which resolves to it");
+		rms.emplace(aid, rm);
+		alias_ids.insert(aid);
+		decl_log.push_back(aid);
+		return rm;
+	}
+
+	/**
+		Register the declarations of a module, to be run on demand.
+
+		@param exports the resources declared by the module
+		@param declare the code declaring the resources of the module
+		@throws config_error if an exported resource is already declared,
+		        or exported by another module
+
+		The declaration code runs once, when one of the exported resources
+		is first looked up (e.g., by `get()`, or by declaring it), or when
+		all modules are needed (see `load_modules()`). Until then, the cost
+		of a module is its list of exports. A module may use resources of
+		other modules.
+		@see lazy_module
+	  */
+	void add_module(std::vector<resourceid> exports, std::function<void()> declare)
+	{
+		for(auto& rid : exports)
+			if(rms.count(rid) || lazy.count(rid))
+				throw config_error(u::str_builder() << "Cannot export " << rid
+					<< " from a module, it is already declared");
+		auto thunk = std::make_shared<module_thunk>();
+		thunk->exports = std::move(exports);
+		thunk->declare = std::move(declare);
+		for(auto& rid : thunk->exports)
+			lazy.emplace(rid, thunk);
+		++ n_modules;
+	}
+
+	/**
+		Run the declaration code of all modules not loaded yet.
+
+		This is done by every call that needs the whole configuration:
+		`check_consistency()`, `prefork()`, `resource_managers()` and
+		`declarations()` (hence also the lookups of `select()`).
+	  */
+	void load_modules() {
+		while(! lazy.empty())
+			load_module(lazy.begin()->first);
+	}
+
+	/** Return the number of modules whose declaration code has not run */
+	inline size_t pending_modules() const { return n_modules; }
+
+	/** Return true if a resource id is declared as an alias */
+	inline bool is_alias(const resourceid& rid) const { return alias_ids.count(rid)>0; }
+
+	/**
+		Prepare the container to be shared with forked processes.
+
+		Worker processes forked after resources have been instantiated share
+		the memory pages of the container with the parent, copy-on-write.
+		Normally, the read paths write to these pages: copying qualifiers and
+		resource ids updates shared_ptr reference counts, and comparing them
+		merges equal states.
+
+		This call makes the resource ids and scope qualifiers of all declared
+		resources refcount-free (see `utilities::make_immortal()`), and turns
+		off merging in comparisons. After it, getting a resource instance that
+		already exists, through a `resource` object constructed before the
+		fork, only reads the shared metadata.
+
+		The pending modules are loaded first (see `load_modules()`), so that
+		forked processes do not load them each. Resources may still be
+		declared and instantiated afterwards; they just do not benefit.
+	  */
+	void prefork() {
+		load_modules();
+		detail::preforked = true;
+		for(auto& [rid, rm] : rms) {
+			rid.immortalize();
+			rm->immortalize();
+		}
+	}
+
+	/** Return true if `prefork()` has been called */
+	inline bool preforked() const { return detail::preforked; }
+
 	/**
 		Return the collection of all resource managers.
+
+		Aliases are included, mapped to the resource manager of their target.
+		The pending modules are loaded first.
 	  */
-	inline auto resource_managers() const { return rms; }
+	inline auto resource_managers() {
+		load_modules();
+		return rms;
+	}
+
+	/**
+		Return the number of declared resources (not counting aliases).
+
+		Unlike `resource_managers()`, this can be read safely from any thread.
+	  */
+	inline size_t declared() const { return n_declared.load(std::memory_order_relaxed); }
+
+	/**
+		Return the ids of all declared resources and aliases, in order of declaration.
+
+		Indexes over the declared resources can be maintained by scanning
+		the entries added since their last scan. The pending modules are
+		loaded first.
+		@see epoch()
+	  */
+	inline const std::vector<resourceid>& declarations() {
+		load_modules();
+		return decl_log;
+	}
+
+	/**
+		Return the number of times the container has been cleared.
+
+		An index built from `declarations()` is stale when this changes.
+	  */
+	inline size_t epoch() const { return n_cleared; }
 
 
 	void clear();
 
+	/**
+		Register a call that `clear()` makes before disposing the global
+		instances, for scopes which keep instances of their own outside
+		any context (e.g., `RefreshScope`). Hooks are kept across clears.
+	  */
+	inline void on_clear(std::function<void()> hook) {
+		clear_hooks.push_back(std::move(hook));
+	}
+
+	/**
+		Return the registry of lifecycle observers.
+	  */
+	inline lifecycle_observers& observers() { return events; }
+
+	/**
+		Nesting depth of instantiations beyond which dependencies are
+		resolved iteratively.
+
+		Instantiating a resource calls its provider, which instantiates the
+		dependencies, and so on; the depth of the native stack grows with the
+		length of dependency chains. Past this depth, the container first
+		walks the chains of provider dependencies on a heap-allocated stack,
+		providing them bottom-up, so that chain length is only limited by
+		memory. Dependencies in `New` scope are not walked, since they are
+		re-instantiated at each injection.
+	  */
+	static constexpr size_t max_recursion = 32;
+
+	/**
+		Maximum nesting of the exception reported for a failure in a
+		dependency chain resolved iteratively; the intermediate
+		levels are summarized.
+	  */
+	static constexpr size_t max_error_nesting = 32;
+
+	/**
+		Enable or disable parallel resolution of dependencies.
+
+		@param nthreads the number of worker threads; 0 disables parallel resolution
+
+		When enabled, instantiating a resource first looks for dependencies
+		of its provider and injectors (transitively) which do not exist yet
+		and whose providers take no resources. The providers of these
+		independent dependencies are run concurrently on a work-stealing pool,
+		and the instantiation proceeds as usual when they have all returned.
+		A provider that throws is not run again; its error is reported when
+		the instantiation reaches its resource.
+
+		Only providers run concurrently; the container itself is accessed
+		from the calling thread only. Providers of leaf dependencies must
+		therefore be safe to run concurrently with each other, and must not
+		access the container.
+	  */
+	void set_parallel(size_t nthreads) {
+		pool.reset(nthreads>0 ? new work_stealing_pool(nthreads) : nullptr);
+	}
+
+	/** Return the number of threads used for parallel resolution (0 if disabled) */
+	inline size_t parallel() const { return pool ? pool->size() : 0; }
+
 
 	//=========================================
 	//
@@ -120,6 +333,100 @@ private:
 
 	std::stack<deferred_work> deferred_injection;
 	std::stack<deferred_work> deferred_creation;
+	lifecycle_observers events;
+	std::unique_ptr<work_stealing_pool> pool;
+
+	// The errors of providers that failed in parallel; the resolution of
+	// these resources rethrows them, rather than running the providers again
+	std::unordered_map<const contextual_base*, std::exception_ptr> prefetch_errors;
+
+	// Forgets the errors of the prefetches of its owner, when it is done
+	struct prefetch_guard {
+		container& c;
+		std::vector<const contextual_base*> failed;
+		inline prefetch_guard(container& _c) : c(_c) { }
+		inline ~prefetch_guard() {
+			for(auto rm : failed) c.prefetch_errors.erase(rm);
+		}
+	};
+
+	// Provide the independent dependencies of rm in parallel
+	void prefetch(contextual_base* rm, prefetch_guard& guard);
+
+	// Provide in parallel the resources reachable from todo (through
+	// resources that exist) whose providers take no resources. The
+	// resources whose providers fail are added to the guard.
+	void prefetch_from(std::vector<contextual_base*>& todo,
+		std::unordered_set<contextual_base*>& seen, prefetch_guard& guard);
+
+	// Nesting depth of get_any()
+	size_t depth = 0;
+
+	struct depth_guard {
+		size_t& d;
+		inline depth_guard(size_t& _d) : d(_d) { ++d; }
+		inline ~depth_guard() { --d; }
+	};
+
+	// Provide the dependency chains of rm without recursion
+	void resolve_chain(contextual_base* rm);
+
+	// Return the manager of a resource in New scope, for get_n()
+	template <typename Resource>
+	resource_manager<Resource>* transient_manager(const Resource& r);
+
+	// Implementation of get_n() for output iterators
+	template <typename Resource, typename OutputIterator>
+	OutputIterator make_n(const Resource& r, size_t n, OutputIterator out);
+
+	// Wrap an error into an instantiation_error
+	static std::exception_ptr nest_error(std::exception_ptr inner, const std::string& msg) {
+		try {
+			std::rethrow_exception(inner);
+		} catch(...) {
+			try {
+				std::throw_with_nested(instantiation_error(msg));
+			} catch(...) {
+				return std::current_exception();
+			}
+		}
+	}
+
+	// Run the provider of a new asset (or rethrow the error of its
+	// provider, if it failed in parallel)
+	void provide_asset(contextual_base* rm, asset* ass) {
+		if(! prefetch_errors.empty()) {
+			auto iter = prefetch_errors.find(rm);
+			if(iter!=prefetch_errors.end()) {
+				std::exception_ptr error = iter->second;
+				prefetch_errors.erase(iter);
+				std::rethrow_exception(error);
+			}
+		}
+		std::chrono::steady_clock::time_point start;
+		bool timed = events.timing();
+		if(timed) start = std::chrono::steady_clock::now();
+		auto elapsed = [&]() {
+			return timed ? std::chrono::steady_clock::now() - start
+				: std::chrono::nanoseconds{};
+		};
+		try {
+			rm->provide( ass->object() );
+		} catch(...) {
+			notify(Event::failed, rm, elapsed());
+			throw;
+		}
+		ass->set_phase(Phase::provided);
+		ass->set_manager(rm);
+		notify(Event::provided, rm, elapsed());
+	}
+
+	inline void notify(Event e, const contextual_base* rm,
+		std::chrono::nanoseconds elapsed = {}) {
+		if(events.observing(e))
+			events.notify(e, rm, rm->scope_qual().type(), elapsed);
+	}
+
 	void defer_creation(const deferred_work& work) {
 		if(work.ass->phase()==Phase::provided) {
 			if(work.rm->number_of_injectors()>0) {
@@ -135,6 +442,7 @@ private:
 				return;
 			} else {
 				work.ass->set_phase(Phase::created);
+				notify(Event::created, work.rm);
 			}
 		}
 		assert(work.ass->phase()==Phase::created);
@@ -159,6 +467,7 @@ private:
 				work.create();
 				count++;
 				assert(work.ass->phase()==Phase::created);
+				notify(Event::created, work.rm);
 			}
 			else
 				break;
@@ -183,6 +492,73 @@ public:
 		return std::any_cast<typename Resource::return_type>(get_any(r, p));
 	}
 
+	/**
+		Make `n` new instances of a resource in `New` scope.
+
+		@param r the resource to instantiate
+		@param n the number of instances
+		@param out either an output iterator receiving the instances, or a
+		       `std::vector` of the instance type, to which they are appended
+		@return the output iterator past the last instance (for iterators)
+		@throws instantiation_error if `r` is undeclared or not in `New` scope,
+		        or if the instantiation fails
+
+		The resource manager is looked up and the dependencies of the lifecycle
+		calls are resolved once (see `contextual::prebind()`); then the provider,
+		injectors and initializer are run `n` times, each instance getting its
+		own dependencies in `New` scope. The instances are not stored
+		in any context; they belong to the caller, who can dispose of them by
+		`dispose_n()`.
+
+		A vector is reserved once, so it can serve as a contiguous pool reused
+		by the caller across calls. If the instantiation fails, the instances
+		already appended to a vector are disposed and removed; those already
+		written to an output iterator are left to the caller.
+	  */
+	template <typename Resource, typename Output>
+	auto get_n(const Resource& r, size_t n, Output&& out);
+
+	/**
+		Dispose of a range of instances returned by `get_n()`.
+
+		@param r the resource of the instances
+		@param first the start of the range
+		@param last the end of the range
+	  */
+	template <typename Resource, typename Iterator>
+	void dispose_n(const Resource& r, Iterator first, Iterator last);
+
+	/**
+		Instantiate a set of resources in one pass.
+
+		@param set the resource managers of the resources, in dependency
+		       order (dependencies first)
+		@throws instantiation_error if an instantiation fails
+
+		If parallel resolution is enabled (see `set_parallel()`), the members
+		of the set and their dependencies whose providers take no resources
+		are first provided concurrently; then the members are instantiated
+		in order. Members that already exist are skipped.
+	  */
+	void instantiate_all(const std::vector<contextual_base*>& set);
+
+	/**
+		Instantiate a set of resources speculatively.
+
+		@param set the resource managers of the resources, in dependency
+		       order (dependencies first)
+		@return the number of instances made, and the number of failures
+
+		As `instantiate_all()`, but failures are ignored, and the instances
+		made are marked speculative, until they are first got (which
+		generates an `Event::claimed`). Lifecycle events generated while
+		speculating are delivered while `speculating()` is true.
+	  */
+	std::pair<size_t, size_t> speculate(const std::vector<contextual_base*>& set);
+
+	/** Return true while a speculative instantiation is in progress */
+	inline bool speculating() const { return in_speculation; }
+
 	/**
 		Get an instance with given phase polymorphically.
 
@@ -205,29 +581,36 @@ public:
 				<< text_phase(p) << " phase, for " << rid);
 
 
+		depth_guard guard(depth);
+		prefetch_guard prefetched(*this);
+
 		// get the rm
 		contextual_base* rm;
 		try {
-			rm = rms.at(rid);
+			rm = lookup(rid);
 		} catch(std::out_of_range) {
 			throw instantiation_error(u::str_builder()
 				<< "Undeclared resource in instantiating "<< rid);
 		}
 
-		// Get an asset
-		auto [ass, isnew] = rm->scope().get(rid);
+		// Get an asset; the asset of an alias is the asset of its target
+		const resourceid& key = rm->rid();
+		auto [ass, isnew] = rm->scope().get(key);
 		assert(ass!=nullptr);
 
 		if(isnew) {
 			// New asset, must instantiate
 			assert(ass->phase()== Phase::allocated);
 
+			if(pool) prefetch(rm, prefetched);
+
 			// build the resource
 			try {
-				rm->provide( ass->object() );
-				ass->set_phase(Phase::provided);
+				if(depth > max_recursion)
+					resolve_chain(rm);
+				provide_asset(rm, ass);
 			} catch(...) {
-				rm->scope().drop(rid);
+				rm->scope().drop(key);
 				std::throw_with_nested(instantiation_error(u::str_builder()
 					<< "Error while instantiating " << rid));
 			}
@@ -242,6 +625,10 @@ public:
 				throw instantiation_error(u::str_builder()
 					<< "Cyclical dependency in instantiating " << rid);
 			}
+			if(ass->speculative() && ! in_speculation) {
+				ass->set_speculative(false);
+				notify(Event::claimed, rm);
+			}
 		}
 
 		// ok, at this point we have a provided asset, execute
@@ -253,6 +640,11 @@ public:
 				throw instantiation_error(u::str_builder()
 					<< "Cyclical dependency in instantiating " << rid);
 		}
+
+		// deliver events at quiescent points
+		if(events.observing() && deferred_injection.empty() && deferred_creation.empty())
+			events.flush();
+
 		//return ass->asset::get<typename Resource::return_type>();
 		return ass->object();
 	}
@@ -260,6 +652,46 @@ public:
 
 private:
 	resource_map<contextual_base*> rms;
+	resource_set alias_ids;   // the keys of rms which are aliases
+
+	// the declaration code of a module, shared by its exports
+	struct module_thunk {
+		std::vector<resourceid> exports;
+		std::function<void()> declare;
+	};
+	resource_map<std::shared_ptr<module_thunk>> lazy;   // by exported resource
+	size_t n_modules = 0;
+
+	// Run the module exporting rid, if not loaded yet; return true if one ran
+	bool load_module(const resourceid& rid)
+	{
+		if(lazy.empty()) return false;
+		auto iter = lazy.find(rid);
+		if(iter==lazy.end()) return false;
+		std::shared_ptr<module_thunk> thunk = iter->second;
+		for(auto& x : thunk->exports) lazy.erase(x);
+		-- n_modules;
+		try {
+			thunk->declare();
+		} catch(...) {
+			std::throw_with_nested(config_error(u::str_builder()
+				<< "Error while loading the module declaring " << rid));
+		}
+		return true;
+	}
+
+	// Return the resource manager of rid, loading its module if needed
+	inline contextual_base* lookup(const resourceid& rid) {
+		auto iter = rms.find(rid);
+		if(iter!=rms.end()) return iter->second;
+		if(load_module(rid)) return rms.at(rid);
+		throw std::out_of_range("undeclared resource");
+	}
+	std::atomic<size_t> n_declared {0};
+	std::vector<resourceid> decl_log;   // the keys of rms, in order of declaration
+	size_t n_cleared = 0;
+	std::vector<std::function<void()>> clear_hooks;
+	bool in_speculation = false;
 
 
 	//=========================================
@@ -319,6 +751,7 @@ private:
 
 	void construct_graph(DepGraph& G) const {
 		for(auto& [rid, rm] : rms) {
+			if(is_alias(rid)) continue;
 			rsevent* M = G.get(Phase::allocated, rid);
 			rsevent* P = G.get(Phase::provided, rid);
 			rsevent* I = G.get(Phase::injected, rid);
@@ -401,6 +834,8 @@ public:
 		- all dependencies are declared
 	  */
 	bool check_consistency(std::ostream& rstream) {
+		load_modules();
+
 		// create the causality graph
 		DepGraph G;
 		construct_graph(G);
@@ -453,6 +888,15 @@ resource<Instance>::get() const
 }
 
 
+template <typename Instance>
+const resource<Instance>&
+resource<Instance>::alias_of(const resource<Instance>& target) const
+{
+	providence().alias(*this, target);
+	return *this;
+}
+
+
 /**
 	Return a resource instance for the given resource.
 
@@ -469,6 +913,47 @@ get(const Resource& r) {
 	return providence().get(r, Phase::created);
 }
 
+/**
+	Make `n` new instances of a resource in `New` scope.
+	@see container::get_n()
+  */
+template <typename Resource, typename Output>
+inline auto get_n(const Resource& r, size_t n, Output&& out) {
+	return providence().get_n(r, n, std::forward<Output>(out));
+}
+
+/**
+	Dispose of instances returned by `get_n()`.
+	@see container::dispose_n()
+  */
+template <typename Resource, typename Iterator>
+inline void dispose_n(const Resource& r, Iterator first, Iterator last) {
+	providence().dispose_n(r, first, last);
+}
+
+/**
+	A module whose declarations run on demand.
+
+	Modules are meant to be defined as static objects; the cost of
+	defining one is the list of its exports.
+	```
+	resource<Parser*> parser;
+	resource<Grammar> grammar;
+	inline lazy_module sql_module({parser, grammar}, []() {
+		grammar.provide(load_grammar, "sql.g");
+		parser.provide(make_parser, grammar);
+	});
+	```
+	@see container::add_module()
+  */
+struct lazy_module
+{
+	lazy_module(std::vector<resourceid> exports, std::function<void()> declare) {
+		providence().add_module(std::move(exports), std::move(declare));
+	}
+};
+
+
 template <typename Resource>
 inline resource_manager<Resource>* resource_manager<Resource>::get(const Resource& r)
 {
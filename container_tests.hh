@@ -2,12 +2,17 @@
 
 #include <cxxtest/TestSuite.h>
 
+#include <thread>
+#include <chrono>
+#include <sstream>
+
 #include "cdi.hh"
 
 using namespace cdi;
 using namespace cdi::utilities;
 using namespace std;
 
+DEFINE_QUALIFIER(Part, int, int)
 
 class ContainerSuite : public CxxTest::TestSuite
 {
@@ -30,4 +35,335 @@ public:
 		TS_ASSERT_EQUALS(providence().resource_managers().size(),1);
 	}
 
+	void test_alias()
+	{
+		int made = 0;
+		resource<int> target({Part(1)});
+		target.provide([&]() { return ++made; });
+
+		resource<int> a({Part(2)}), b({Part(3)});
+		a.alias_of(target);
+		b.alias_of(a);  // an alias of an alias is an alias of the target
+		TS_ASSERT(providence().is_alias(a));
+		TS_ASSERT(! providence().is_alias(target));
+		TS_ASSERT_EQUALS(a.manager(), target.manager());
+		TS_ASSERT_EQUALS(b.manager(), target.manager());
+		TS_ASSERT_EQUALS(providence().declared(), 1);
+		TS_ASSERT_THROWS(a.alias_of(target), config_error);
+		TS_ASSERT_THROWS(target.alias_of(a), config_error);
+
+		// an alias cannot resolve to itself
+		resource<int> self({Part(5)});
+		const size_t logged = providence().declarations().size();
+		TS_ASSERT_THROWS(self.alias_of(self), config_error);
+		TS_ASSERT(! providence().is_alias(self));
+		TS_ASSERT_EQUALS(providence().declarations().size(), logged);
+
+		// dependencies on an alias are dependencies on the target
+		resource<int> user({Part(4)});
+		user.provide([](int x) { return 10*x; }, b);
+		TS_ASSERT_EQUALS(user.manager()->provider_injections().front(), target.manager());
+
+		TS_ASSERT_EQUALS(a.get(), 1);
+		TS_ASSERT_EQUALS(user.get(), 10);
+		TS_ASSERT_EQUALS(target.get(), 1);
+		TS_ASSERT_EQUALS(made, 1);
+		TS_ASSERT(providence().check_consistency(cout));
+	}
+
+	void test_prefork()
+	{
+		resource<string> r({Part(1)});
+		r.provide([]() { return string("warm"); });
+		const string& warm = r.get();
+		resource<string> m({Part(2)});
+		providence().add_module(vector<resourceid>{m},
+			[&]() { m.provide([]() { return string("module"); }); });
+
+		// comparisons merge the states of equal qualifiers...
+		qualifier a = Part(7), b = Part(7);
+		TS_ASSERT(a==b);
+		TS_ASSERT_EQUALS(a.get<qual_base>(), b.get<qual_base>());
+
+		providence().prefork();
+		TS_ASSERT(providence().preforked());
+
+		// ...but not after prefork()
+		qualifier c = Part(8), d = Part(8);
+		TS_ASSERT(c==d);
+		TS_ASSERT_DIFFERS(c.get<qual_base>(), d.get<qual_base>());
+
+		// the container's metadata is refcount-free
+		auto rm = r.manager();
+		TS_ASSERT_EQUALS(rm->scope_qual().get<scope_api>().use_count(), 0);
+		for(auto& q : rm->rid().quals())
+			TS_ASSERT_EQUALS(q.get<qual_base>().use_count(), 0);
+
+		// including that of the pending modules
+		TS_ASSERT_EQUALS(providence().pending_modules(), 0);
+		TS_ASSERT_EQUALS(m.manager()->scope_qual().get<scope_api>().use_count(), 0);
+
+		// and reads still work
+		TS_ASSERT_EQUALS(&r.get(), &warm);
+		TS_ASSERT_EQUALS(resource<string>({Part(1)}).get(), "warm");
+	}
+
+	struct ObsScope : LocalScope<ObsScope> { };
+	static inline qualifier Obs { new scope_proxy<ObsScope> };
+
+	void test_observers()
+	{
+		auto& obs = providence().observers();
+		TS_ASSERT(! obs.observing());
+
+		resource<int*> r({Obs});
+		r	.provide([]() { return new int(1); })
+			.dispose([](auto p) { delete p; });
+
+		vector<Event> seen;
+		size_t batches = 0;
+		auto sub = obs.subscribe(all_events, [&](const event_batch& b) {
+			++batches;
+			for(auto& e : b) seen.push_back(e.kind);
+		});
+		size_t created = 0;
+		obs.subscribe(event_bit(Event::created), [&](const event_batch& b) {
+			for(auto& e : b) {
+				TS_ASSERT_EQUALS(e.kind, Event::created);
+				TS_ASSERT_EQUALS(e.manager, r.manager());
+				TS_ASSERT(e.scope == typeid(ObsScope));
+				++created;
+			}
+		});
+		TS_ASSERT(obs.observing(Event::disposed));
+
+		{
+			ObsScope scope;
+			r.get();
+			r.get();
+		}
+		TS_ASSERT_EQUALS(obs.pending(), 0);
+		TS_ASSERT_EQUALS(created, 1);
+		TS_ASSERT_EQUALS(seen, (vector<Event>{ Event::scope_activated, Event::provided,
+			Event::created, Event::disposed, Event::scope_deactivated }));
+		TS_ASSERT(batches < seen.size());
+
+		obs.unsubscribe(sub);
+		TS_ASSERT(obs.observing(Event::created));
+		TS_ASSERT(! obs.observing(Event::disposed));
+	}
+
+	void test_deep_chain()
+	{
+		// far deeper than the native stack allows to recurse
+		const int n = 100000;
+		vector<resource<int>> chain;
+		chain.reserve(n);
+		chain.emplace_back(qualifiers{Part(0)});
+		chain[0].provide([]() { return 0; });
+		for(int i=1; i<n; ++i) {
+			chain.emplace_back(qualifiers{Part(i)});
+			chain[i].provide([](int x) { return x+1; }, chain[i-1]);
+		}
+		TS_ASSERT_EQUALS(chain[n-1].get(), n-1);
+		TS_ASSERT_EQUALS(chain[n/2].get(), n/2);
+	}
+
+	void test_deep_chain_failure()
+	{
+		const int n = 10000;
+		vector<resource<int>> chain;
+		chain.reserve(n);
+		chain.emplace_back(qualifiers{Part(0)});
+		chain[0].provide([]() -> int { throw std::runtime_error("leaf"); });
+		for(int i=1; i<n; ++i) {
+			chain.emplace_back(qualifiers{Part(i)});
+			chain[i].provide([](int x) { return x+1; }, chain[i-1]);
+		}
+
+		size_t nesting = 0;
+		try {
+			chain[n-1].get();
+		} catch(const std::exception& e) {
+			const std::exception* cur = &e;
+			while(cur) {
+				++nesting;
+				try {
+					std::rethrow_if_nested(*cur);
+					cur = nullptr;
+				} catch(const std::exception& inner) {
+					if(nesting > 2*container::max_error_nesting + container::max_recursion) break;
+					cur = &inner;
+				}
+			}
+		}
+		TS_ASSERT(nesting > 0);
+		TS_ASSERT(nesting < 2*container::max_error_nesting + container::max_recursion);
+
+		// nothing was left half-built
+		chain[0].provide([]() { return 0; });
+		TS_ASSERT_EQUALS(chain[n-1].get(), n-1);
+	}
+
+	void test_parallel_fanout()
+	{
+		using namespace std::chrono;
+		providence().set_parallel(4);
+		TS_ASSERT_EQUALS(providence().parallel(), 4);
+
+		auto slow = [](int v) {
+			return [v]() {
+				std::this_thread::sleep_for(milliseconds(50));
+				return v;
+			};
+		};
+		resource<int> a({Part(1)}), b({Part(2)}), c({Part(3)}), d({Part(4)});
+		a.provide(slow(1));
+		b.provide(slow(2));
+		c.provide(slow(3));
+		d.provide(slow(4));
+
+		resource<int> sum_ab({New, Part(12)});
+		sum_ab.provide([](int x, int y) { return x+y; }, a, b);
+		resource<int> total({});
+		total.provide([](int x, int y) { return x+y; }, sum_ab, c);
+		int injected = 0;
+		total.inject([&](int&, int z) { injected = z; }, d);
+
+		auto start = steady_clock::now();
+		TS_ASSERT_EQUALS(total.get(), 6);
+		auto elapsed = steady_clock::now() - start;
+		TS_ASSERT_EQUALS(injected, 4);
+		TS_ASSERT(elapsed < milliseconds(150));
+
+		providence().set_parallel(0);
+		TS_ASSERT_EQUALS(providence().parallel(), 0);
+	}
+
+	void test_parallel_failure()
+	{
+		providence().set_parallel(2);
+
+		resource<int> a({Part(1)}), b({Part(2)});
+		int calls = 0;
+		a.provide([]() { return 1; });
+		b.provide([&]() -> int { ++calls; throw std::runtime_error("b"); });
+		resource<int> sum({Part(12)});
+		sum.provide([](int x, int y) { return x+y; }, a, b);
+
+		TS_ASSERT_THROWS(sum.get(), instantiation_error);
+		TS_ASSERT_EQUALS(calls, 1);  // in parallel, and reported by the resolution
+		TS_ASSERT_EQUALS(a.get(), 1);
+
+		// the error is not kept beyond that resolution
+		TS_ASSERT_THROWS(b.get(), instantiation_error);
+		TS_ASSERT_EQUALS(calls, 2);
+	}
+
+	void test_dedup()
+	{
+		typedef shared_ptr<const string> text;
+		resource<text> a({Part(1)}), b({Part(2)}), c({Part(3)});
+		a.provide([]() { return make_shared<const string>("same"); }).dedup();
+		b.provide([]() { return make_shared<const string>("same"); }).dedup();
+		c.provide([]() { return make_shared<const string>("other"); }).dedup();
+
+		auto& st = cdi::detail::dedup_storage<string, hash<string>, equal_to<string>>();
+		TS_ASSERT_EQUALS(a.get(), b.get());
+		TS_ASSERT_DIFFERS(a.get(), c.get());
+		TS_ASSERT_EQUALS(*c.get(), "other");
+		TS_ASSERT_EQUALS(st.size(), 2);
+
+		// values are released with their last instance
+		providence().clear();
+		TS_ASSERT_EQUALS(st.size(), 0);
+
+		// a case-insensitive equality
+		struct nocase_hash {
+			size_t operator()(const string& s) const { return s.size(); }
+		};
+		struct nocase_eq {
+			bool operator()(const string& x, const string& y) const {
+				return std::equal(x.begin(), x.end(), y.begin(), y.end(),
+					[](char p, char q) { return tolower(p)==tolower(q); });
+			}
+		};
+		resource<text> x({Part(1)}), y({Part(2)});
+		x.provide([]() { return make_shared<const string>("Key"); }).dedup<nocase_hash, nocase_eq>();
+		y.provide([]() { return make_shared<const string>("KEY"); }).dedup<nocase_hash, nocase_eq>();
+		TS_ASSERT_EQUALS(*x.get(), "Key");
+		TS_ASSERT_EQUALS(y.get(), x.get());
+		TS_ASSERT_EQUALS(*y.get(), "Key");
+		providence().clear();
+
+		// values are shared once initialized
+		auto finish = [](text& t) { t = make_shared<const string>(*t + "!"); };
+		resource<text> p({Part(1)}), q({Part(2)});
+		p.provide([]() { return make_shared<const string>("hi"); })
+			.initialize(finish).dedup();
+		q.provide([]() { return make_shared<const string>("hi"); })
+			.initialize(finish).dedup();
+		TS_ASSERT_EQUALS(*p.get(), "hi!");
+		TS_ASSERT_EQUALS(p.get(), q.get());
+		TS_ASSERT_EQUALS(st.size(), 1);
+
+		// shared values are not disposed
+		TS_ASSERT_THROWS(p.dispose([](text&) {}), config_error);
+		resource<text> r({Part(3)});
+		r.provide([]() { return make_shared<const string>("hi"); })
+			.dispose([](text&) {});
+		TS_ASSERT_THROWS(r.dedup(), config_error);
+
+		providence().clear();
+		TS_ASSERT_EQUALS(st.size(), 0);
+	}
+
+	void test_lazy_modules()
+	{
+		int loaded_a = 0, loaded_b = 0;
+		resource<int> a({Part(1)}), b({Part(2)}), c({Part(3)});
+		size_t declared = providence().declared();
+		vector<resourceid> ab {a, b}, just_b {b}, just_c {c};
+		providence().add_module(ab, [&]() {
+			++loaded_a;
+			a.provide([]() { return 1; });
+			b.provide([](int x) { return x+1; }, c);
+		});
+		providence().add_module(just_c, [&]() {
+			++loaded_b;
+			c.provide([]() { return 10; });
+		});
+		TS_ASSERT_THROWS(providence().add_module(just_b, []() {}), config_error);
+		TS_ASSERT_EQUALS(providence().pending_modules(), 2);
+		TS_ASSERT_EQUALS(providence().declared(), declared);
+
+		// the first lookup runs the module, and its dependencies' modules
+		TS_ASSERT_EQUALS(b.get(), 11);
+		TS_ASSERT_EQUALS(loaded_a, 1);
+		TS_ASSERT_EQUALS(loaded_b, 1);
+		TS_ASSERT_EQUALS(a.get(), 1);
+		TS_ASSERT_EQUALS(loaded_a, 1);
+		TS_ASSERT_EQUALS(providence().pending_modules(), 0);
+
+		// consistency checks load all modules
+		resource<int> d({Part(4)});
+		lazy_module mod_d(vector<resourceid>(1, d), [&]() { d.provide([]() { return 4; }); });
+		ostringstream report;
+		TS_ASSERT(providence().check_consistency(report));
+		TS_ASSERT_EQUALS(providence().pending_modules(), 0);
+		TS_ASSERT(providence().get_declared(d)!=nullptr);
+
+		// and so does listing the resource managers
+		resource<int> f({Part(6)});
+		providence().add_module(vector<resourceid>{f}, [&]() { f.provide([]() { return 6; }); });
+		TS_ASSERT(providence().resource_managers().contains(f));
+		TS_ASSERT_EQUALS(providence().pending_modules(), 0);
+
+		// a failing module
+		resource<int> e({Part(5)});
+		vector<resourceid> just_e {e};
+		providence().add_module(just_e, []() { throw runtime_error("broken"); });
+		TS_ASSERT_THROWS(e.get(), config_error);
+	}
+
 };
@@ -3,7 +3,13 @@
 #include "resource.hh"
 
 #include <any>
+#include <mutex>
 #include <vector>
+#include <unordered_map>
+#include <memory>
+#include <memory_resource>
+#include <functional>
+#include <cassert>
 
 //=================================
 //
@@ -25,6 +31,14 @@ public:
 	virtual std::tuple<asset*, bool>
 	 		get(const resourceid&) const =0;
 	virtual	void drop(const resourceid&) const =0;
+
+	/**
+		Return the memory resource of the active context of the scope.
+		By default, this is the default memory resource.
+	  */
+	virtual std::pmr::memory_resource* memory() const {
+		return std::pmr::get_default_resource();
+	}
 };
 
 
@@ -52,6 +66,8 @@ enum class Phase {
 
 	@see Phase
   */
+class contextual_base;
+
 class asset
 {
 public:
@@ -70,6 +86,21 @@ public:
 	/** Set the phase for this asset */
 	inline void set_phase(Phase p) { ph=p; }
 
+	/** Return the manager of the resource, once provided (else null) */
+	inline contextual_base* manager() const { return rm; }
+
+	/** Set the manager of the resource */
+	inline void set_manager(contextual_base* m) { rm=m; }
+
+	/**
+		Return true if the asset was instantiated speculatively, and has
+		not been got since (see `container::speculate()`)
+	  */
+	inline bool speculative() const { return spec; }
+
+	/** Mark or unmark the asset as speculative */
+	inline void set_speculative(bool on) { spec=on; }
+
 	/**
 		Get an object of the provided value stored inside the asset
 		@tparam Value the type of the value, which must be CopyConstructible
@@ -100,12 +131,11 @@ public:
 private:
 	std::any obj;
 	Phase ph;
+	contextual_base* rm = nullptr;
+	bool spec = false;
 };
 
 
-// forward
-class contextual_base;
-
 /**
 	This sequence container is returned by the
 	type-erase resource manager, to denote known injections
@@ -192,9 +222,254 @@ namespace detail {
 	template <typename FSig>
 	struct typed_call : call {
 		std::function<FSig> func;
+		// returns func, with the resource arguments resolved
+		std::function<std::function<FSig>()> prebind;
+	};
+
+	// The table of unique values of a deduplicated instance type; it is
+	// never destroyed, since instances may outlive static destruction
+	template <typename Value, typename Hash, typename Equal>
+	inline auto& dedup_storage() {
+		static auto* st = new u::unique_storage<Value, Hash, Equal, std::mutex>();
+		return *st;
+	}
+
+	template <typename T>
+	struct is_shared_ptr : std::false_type { };
+	template <typename T>
+	struct is_shared_ptr< std::shared_ptr<T> > : std::true_type { };
+
+	// this call is implemented later, with the scopes: true if the
+	// resource is in New scope
+	inline bool is_transient(const contextual_base*);
+
+	// True if the instances of a type can be told apart after they are
+	// returned (by the object they point to)
+	template <typename T>
+	inline constexpr bool has_identity =
+		(std::is_pointer_v<T> && std::is_object_v<std::remove_pointer_t<T>>)
+		|| is_shared_ptr<T>::value;
+
+	template <typename T>
+	inline const void* identity_of(const T& obj) {
+		if constexpr (std::is_pointer_v<T>) return obj;
+		else return obj.get();
+	}
+
+	// Finishes a transient instance: disposes it (true), or forgets the
+	// transient dependencies it owns (false)
+	typedef std::function<void(bool)> transient_end;
+
+	// Run the ends of transient instances, latest first; the first error
+	// is rethrown
+	inline void end_transients(std::vector<transient_end>& made, bool dispose)
+	{
+		std::exception_ptr error;
+		for(auto it = made.rbegin(); it!=made.rend(); ++it)
+			try {
+				(*it)(dispose);
+			} catch(...) {
+				if(! error) error = std::current_exception();
+			}
+		made.clear();
+		if(error) std::rethrow_exception(error);
+	}
+
+	// The transient (New-scope) dependencies made for the lifecycle calls
+	// running on this thread
+	struct transient_frame {
+		std::vector<transient_end> made;
+		transient_frame* const saved;
+
+		transient_frame() : saved(current) { current = this; }
+		~transient_frame() { current = saved; }
+		transient_frame(const transient_frame&) = delete;
+		transient_frame& operator=(const transient_frame&) = delete;
+
+		static inline thread_local transient_frame* current = nullptr;
+	};
+
+	// The transient dependencies of the live instances of a resource,
+	// by the identity of the instance
+	class transient_registry {
+	public:
+		void adopt(const void* id, std::vector<transient_end> made) {
+			std::lock_guard<std::mutex> lock(mutex);
+			// deduplicated instances may share an identity
+			auto& deps = owned[id];
+			deps.insert(deps.end(), std::make_move_iterator(made.begin()),
+				std::make_move_iterator(made.end()));
+		}
+
+		// Dispose (or just forget) the dependencies of an instance
+		void end(const void* id, bool dispose) {
+			std::vector<transient_end> made;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto iter = owned.find(id);
+				if(iter==owned.end()) return;
+				made = std::move(iter->second);
+				owned.erase(iter);
+			}
+			end_transients(made, dispose);
+		}
+
+	private:
+		std::mutex mutex;
+		std::unordered_map<const void*, std::vector<transient_end>> owned;
 	};
 }
 
+template <typename Instance>
+struct prebound_lifecycle;
+
+namespace detail {
+	// A resolved resource argument of a prebound call: the instance of the
+	// dependency, or the lifecycle of a transient dependency, which makes
+	// a new instance at each call (New scope overwrites its instance on the
+	// next get, and would share it between calls)
+	template <typename Arg>
+	struct prebound_arg {
+		typedef typename Arg::instance_type value_type;
+		typedef typename Arg::return_type return_type;
+
+		std::conditional_t< std::is_reference_v<return_type>,
+			const value_type*, value_type> resolved {};
+		std::shared_ptr<const prebound_lifecycle<value_type>> transient;
+
+		return_type get() const {
+			if(transient) return make();
+			if constexpr (std::is_reference_v<return_type>)
+				return *resolved;
+			else
+				return resolved;
+		}
+
+		// Make an instance, owned by the lifecycle call being run
+		const value_type& make() const {
+			auto obj = std::make_shared<value_type>(transient->create());
+			transient_frame* frame = transient_frame::current;
+			assert(frame!=nullptr);
+			frame->made.push_back([lc=transient, obj](bool dispose) {
+				if(dispose) lc->dispose(*obj);
+				else lc->release(*obj);
+			});
+			return *obj;
+		}
+	};
+
+	// Resolve an argument of a lifecycle call once: resources are replaced by
+	// (a reference to) their instance, or the lifecycle of transient ones;
+	// other arguments are passed through
+	template <typename Arg>
+	auto prebind_arg(const Arg& arg)
+	{
+		if constexpr (is_resource_type<Arg>) {
+			prebound_arg<Arg> pa;
+			auto rm = arg.manager();
+			if(is_transient(rm))
+				pa.transient = rm->prebind();
+			else if constexpr (std::is_reference_v<typename Arg::return_type>)
+				pa.resolved = &inject_partial<Arg>(arg, Phase::created);
+			else
+				pa.resolved = inject_partial<Arg>(arg, Phase::created);
+			// a nested bind expression, evaluated when the call is made
+			return std::bind(&prebound_arg<Arg>::get, std::move(pa));
+		} else
+			return arg;
+	}
+}
+
+
+/**
+	The lifecycle calls of a resource, bound to resolved dependencies.
+
+	The resource arguments of the provider, injectors, initializer and
+	disposer are resolved once, when the lifecycle is prebound (see
+	`contextual::prebind()`). Resources whose instance type is not scalar
+	are bound by reference to their instance, which must therefore stay
+	alive (i.e., their scope must stay active) while the lifecycle is used.
+	Other arguments are bound as they are in the resource manager;
+	in particular, bind expressions are still evaluated at each call.
+
+	Resources in New scope are the exception: each instance created gets
+	new instances of them, as with `get()`. If the instance type is a
+	pointer (or shared pointer), these transient dependencies are disposed
+	with the instance; otherwise they are not disposed, as with `get()`.
+
+	@tparam Instance the instance type of the resource
+  */
+template <typename Instance>
+struct prebound_lifecycle
+{
+	std::function<Instance()> provider;
+	std::vector< std::function<void(Instance&)> > injectors;
+	std::function<void(Instance&)> initializer;
+	std::function<void(Instance&)> disposer;
+
+	/// The transient dependencies of the instances (null if not tracked)
+	std::shared_ptr<detail::transient_registry> transients;
+
+	/**
+		Return a new instance, provided, injected and initialized.
+	  */
+	Instance create() const {
+		detail::transient_frame frame;
+		try {
+			Instance obj = provider();
+			for(auto& inj : injectors)
+				inj(obj);
+			if(initializer) initializer(obj);
+			if(! frame.made.empty()) {
+				if constexpr (detail::has_identity<Instance>)
+					if(transients) {
+						transients->adopt(detail::identity_of(obj), std::move(frame.made));
+						return obj;
+					}
+				detail::end_transients(frame.made, false);
+			}
+			return obj;
+		} catch(...) {
+			try {
+				detail::end_transients(frame.made, true);
+			} catch(...) { }
+			throw;
+		}
+	}
+
+	/**
+		Dispose an instance returned by `create()`, and its transient
+		dependencies.
+	  */
+	void dispose(Instance& obj) const {
+		detail::transient_frame frame;  // for the arguments of the disposer
+		std::exception_ptr error;
+		try {
+			if(disposer) disposer(obj);
+		} catch(...) {
+			error = std::current_exception();
+		}
+		try {
+			detail::end_transients(frame.made, true);
+			if constexpr (detail::has_identity<Instance>)
+				if(transients) transients->end(detail::identity_of(obj), true);
+		} catch(...) {
+			if(! error) error = std::current_exception();
+		}
+		if(error) std::rethrow_exception(error);
+	}
+
+	/**
+		Forget the transient dependencies of an instance returned by
+		`create()`, without disposing them. This is for instances which are
+		handed over to a scope that does not dispose them.
+	  */
+	void release(const Instance& obj) const {
+		if constexpr (detail::has_identity<Instance>)
+			if(transients) transients->end(detail::identity_of(obj), false);
+	}
+};
+
 
 /**
 	Base class for resource managers.
@@ -208,24 +483,34 @@ public:
 		@param r the resource id
 	  */
 	contextual_base(const resourceid& r)
-	: _rid(r), scopeq(scope_spec(r.quals())) { }
+	: _rid(r), scopeq(scope_spec(r.quals())),
+	  scope_ptr(scopeq.get<scope_api>().get()) { }
 
 	/** Virtual destructor */
 	virtual ~contextual_base() { }
 
 	/** The resource id of the managed resource */
-	inline resourceid rid() const { return _rid; }
+	inline const resourceid& rid() const { return _rid; }
 
 	/**
 		Return the scope API for this resource.
 	  */
-	inline const scope_api& scope() const { return *scopeq.get<scope_api>(); }
+	inline const scope_api& scope() const { return *scope_ptr; }
 
 	/**
 		Return the scope API for this resource as a qualifier.
 	  */
 	inline qualifier scope_qual() const { return scopeq; }
 
+	/**
+		Make the resource id and scope qualifier refcount-free.
+		@see container::prefork()
+	  */
+	void immortalize() const {
+		_rid.immortalize();
+		scopeq.immortalize();
+	}
+
 	/** Return the set of resources required for instantiation */
 	virtual const injection_list& provider_injections() const = 0;
 
@@ -262,9 +547,36 @@ public:
 	/** Disposes a resource instance polymorphically. */
 	virtual void dispose(std::any&) const = 0;
 
+	/**
+		Return true if instances must be disposed on the thread that
+		deactivates their scope (see `reclaimer`).
+
+		This is the case if it was requested by `set_sync_disposal()`, or
+		if the disposer has resource arguments, which are resolved by the
+		container.
+	  */
+	inline bool sync_disposal() const {
+		return sync_disp || ! disposer_injections().empty();
+	}
+
+	/** Require instances to be disposed synchronously */
+	inline void set_sync_disposal(bool on) { sync_disp = on; }
+
+	/**
+		Return true if the lifecycle calls of the resource have no side
+		effects, so that instances may be made speculatively.
+	  */
+	inline bool is_pure() const { return pure_flag; }
+
+	/** Declare the lifecycle calls of the resource side-effect free */
+	inline void set_pure(bool on) { pure_flag = on; }
+
 private:
 	resourceid _rid;  // rid
 	qualifier scopeq; // scope qualifier
+	const scope_api* scope_ptr; // the scope api, owned by scopeq
+	bool sync_disp = false;
+	bool pure_flag = false;
 };
 
 
@@ -286,6 +598,9 @@ public:
 	void provider(Callable&& func, Args&& ... args  )
 	{
 		prov.injected.clear();
+		prov.prebind = [func, args...]() -> std::function<instance_type()> {
+			return std::bind(func, detail::prebind_arg(args)...);
+		};
  		prov.func = std::bind(std::forward<Callable>(func),
  			prov.unwrap_inject(Phase::provided, std::forward<Args>(args))... );
 	}
@@ -296,6 +611,9 @@ public:
 	{
  		using namespace std::placeholders;
  		init.injected.clear();
+		init.prebind = [func, args...]() -> std::function<void(instance_type&)> {
+			return std::bind(func, _1, detail::prebind_arg(args)...);
+		};
  		init.func = std::bind(std::forward<Callable>(func),
  			_1, disp.unwrap_inject(Phase::injected, std::forward<Args>(args))... );
 	}
@@ -305,7 +623,13 @@ public:
 	void disposer(Callable&& func, Args&& ... args )
 	{
  		using namespace std::placeholders;
+		if(canon)
+			throw config_error(utilities::str_builder()
+				<< "A deduplicated resource cannot have a disposer: " << rid());
  		disp.injected.clear();
+		disp.prebind = [func, args...]() -> std::function<void(instance_type&)> {
+			return std::bind(func, _1, detail::prebind_arg(args)...);
+		};
  		disp.func = std::bind(std::forward<Callable>(func),
  			_1, disp.unwrap_inject(Phase::created, std::forward<Args>(args))... );
 	}
@@ -317,6 +641,9 @@ public:
  		using namespace std::placeholders;
  		injectors.push_back( detail::typed_call<void(instance_type&)>() );
  		auto& inj = injectors.back();
+		inj.prebind = [func, args...]() -> std::function<void(instance_type&)> {
+			return std::bind(func, _1, detail::prebind_arg(args)...);
+		};
  		inj.func = std::bind(std::forward<Callable>(func),
  			_1, inj.unwrap_inject(Phase::provided, std::forward<Args>(args))... );
 	}
@@ -345,6 +672,37 @@ public:
 		return prov.func();
 	}
 
+	/**
+		Make created instances canonical, so that equal values are shared.
+
+		@tparam Hash the hash function of the values
+		@tparam Equal the equality of the values
+		@throw config_error if the resource has a disposer
+
+		Each instance (a shared pointer to const), once initialized, is replaced
+		by a pointer to the unique stored value equal to it, if there is one.
+		The table of values is shared by all resources with the same instance
+		type, hash and equality, and holds each value while an instance refers
+		to it. Since the values are shared, they are never disposed.
+	  */
+	template <typename Hash, typename Equal>
+	void deduplicate()
+	{
+		static_assert(detail::is_shared_ptr<instance_type>::value,
+			"Only resources whose instances are shared pointers can be deduplicated");
+		typedef typename instance_type::element_type element_type;
+		static_assert(std::is_const_v<element_type>,
+			"Only shared pointers to const values can be deduplicated");
+		typedef std::remove_const_t<element_type> value_type;
+		if(disp.func)
+			throw config_error(utilities::str_builder()
+				<< "A resource with a disposer cannot be deduplicated: " << rid());
+		canon = [](instance_type& obj) {
+			if(! obj) return;
+			obj = detail::dedup_storage<value_type, Hash, Equal>().allocate(*obj);
+		};
+	}
+
 	/**
 		Inject an object.
 		@param obj reference to the object to be injected
@@ -368,8 +726,9 @@ public:
 		@param obj reference to the object to be disposed
 	  */
 	inline void initialize_instance(instance_type& obj) const {
-		if(! init.func) return; // letting the disposer be null is not an error
-		init.func(obj);
+		// letting the initializer be null is not an error
+		if(init.func) init.func(obj);
+		if(canon) canon(obj);
 	}
 
 	/**
@@ -397,6 +756,48 @@ public:
 		dispose_instance(std::any_cast<instance_type&>(obj));
 	}
 
+	/**
+		Return the lifecycle calls of this resource, with their resource
+		arguments resolved.
+
+		Each call to this method resolves the dependencies anew.
+		@throw instantiation_error if a provider is not set, or if resolving
+		a dependency fails.
+	  */
+	std::shared_ptr<const prebound_lifecycle<instance_type>> prebind() const {
+		namespace u=utilities;
+		if(! prov.func)
+			throw instantiation_error(u::str_builder()
+				<< "A provider is not set for resource " << rid());
+		auto lc = std::make_shared<prebound_lifecycle<instance_type>>();
+		lc->provider = prov.prebind();
+		for(auto& inj : injectors)
+			lc->injectors.push_back(inj.prebind());
+		if(init.func) lc->initializer = init.prebind();
+		lc->transients = transients;
+		if(canon)
+			lc->initializer = [i=std::move(lc->initializer), c=canon](instance_type& obj) {
+				if(i) i(obj);
+				c(obj);
+			};
+		if(disp.func) lc->disposer = disp.prebind();
+		return lc;
+	}
+
+	/**
+		Return the disposer of this resource, with its resource arguments
+		resolved, for instances returned by a prebound lifecycle: it also
+		disposes their transient dependencies (see `prebound_lifecycle`).
+		Return an empty function if there is nothing to dispose.
+	  */
+	std::function<void(instance_type&)> prebind_disposer() const {
+		if(! disp.func && ! transients) return {};
+		auto lc = std::make_shared<prebound_lifecycle<instance_type>>();
+		if(disp.func) lc->disposer = disp.prebind();
+		lc->transients = transients;
+		return [lc](instance_type& obj) { lc->dispose(obj); };
+	}
+
 	//================================
 	// introspection for optimization
 	//================================
@@ -405,8 +806,9 @@ public:
 		return bool( prov.func );
 	}
 
+	// deduplication is done at initialization
 	virtual bool has_initializer() const override {
-		return bool( init.func );
+		return init.func || canon;
 	}
 
 	virtual bool has_disposer() const override {
@@ -437,6 +839,12 @@ private:
 	std::vector< detail::typed_call<void(instance_type&)> > injectors;
 	detail::typed_call<void(instance_type&)> init;
 	detail::typed_call<void(instance_type&)> disp;
+	std::function<void(instance_type&)> canon;  // set by deduplicate()
+
+	// the transient dependencies of prebound instances, if they can be told apart
+	std::shared_ptr<detail::transient_registry> transients =
+		detail::has_identity<instance_type>
+			? std::make_shared<detail::transient_registry>() : nullptr;
 };
 
 
@@ -491,6 +899,37 @@ resource<Instance>::provide(Callable func, Args&& ... args ) const
  	return (*this);
 }
 
+template <typename Instance>
+const resource<Instance> &
+resource<Instance>::dispose_synchronously() const
+{
+ 	resource_manager<resource_type>* rm = manager();
+ 	rm->set_sync_disposal(true);
+ 	return (*this);
+}
+
+template <typename Instance>
+const resource<Instance> &
+resource<Instance>::pure() const
+{
+ 	resource_manager<resource_type>* rm = manager();
+ 	rm->set_pure(true);
+ 	return (*this);
+}
+
+template <typename Instance>
+template <typename Hash, typename Equal>
+const resource<Instance> &
+resource<Instance>::dedup() const
+{
+	typedef std::remove_const_t<typename Instance::element_type> value_type;
+ 	resource_manager<resource_type>* rm = manager();
+ 	rm->template deduplicate<
+ 		std::conditional_t<std::is_void_v<Hash>, std::hash<value_type>, Hash>,
+ 		std::conditional_t<std::is_void_v<Equal>, std::equal_to<value_type>, Equal> >();
+ 	return (*this);
+}
+
 template <typename Instance>
 template <typename Callable, typename...Args>
 const resource<Instance> &
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "container.hh"
+
+//=================================
+//
+//  factories
+//
+//=================================
+
+namespace cdi {
+
+
+/**
+	A callable object creating instances of a resource.
+
+	A factory holds the lifecycle calls of a resource, with the resource's
+	dependencies resolved once, when the factory was made. Each call runs
+	only the bodies of the provider, injectors and initializer; there is no
+	container lookup, scope dispatch or dependency resolution.
+	```
+	resource<Widget*> widget({New});
+	widget.provide([](const Config& c) { return new Widget(c); }, config);
+
+	resource<Maker> maker({});
+	maker.provide([](const factory<Widget*>& f) { return Maker(f); }, factory_of(widget));
+	...
+	Widget* w = f();      // inside Maker
+	f.dispose(w);
+	```
+	The instances made by a factory are not stored in any context; the
+	caller owns them, and can dispose of them by `dispose()`.
+
+	A factory binds non-scalar dependencies by reference, except those in
+	New scope: each instance gets new ones, which `dispose()` disposes with
+	it (see `prebound_lifecycle`). A factory must not be used after the
+	scopes of its other dependencies are deactivated.
+
+	@tparam Instance the instance type of the resource
+	@see factory_of()
+  */
+template <typename Instance>
+class factory
+{
+public:
+	/// The type of the instances made
+	typedef Instance instance_type;
+
+	/// Construct an empty factory
+	factory() { }
+
+	/// Construct a factory for a prebound lifecycle
+	explicit factory(std::shared_ptr<const prebound_lifecycle<Instance>> lc)
+	: lifecycle(std::move(lc)) { }
+
+	/// Return a new instance
+	inline Instance operator()() const { return lifecycle->create(); }
+
+	/// Dispose an instance made by this factory
+	inline void dispose(Instance& obj) const { lifecycle->dispose(obj); }
+
+	/// Return true if the factory is not empty
+	inline explicit operator bool() const { return bool(lifecycle); }
+
+private:
+	std::shared_ptr<const prebound_lifecycle<Instance>> lifecycle;
+};
+
+
+/**
+	Return a resource whose instances are factories for a resource.
+
+	@tparam Instance the instance type of r
+	@param r the resource made by the factories
+	@return a resource of type `resource<factory<Instance>>` with the same
+	        qualifiers (and hence scope) as `r`
+
+	The returned resource is declared, with a provider which resolves the
+	dependencies of `r`. It can be injected like any other resource.
+	Note that the dependencies of `r` are resolved within the provider,
+	so they do not appear in the dependency graph of the factory resource.
+  */
+template <typename Instance>
+resource<factory<Instance>> factory_of(const resource<Instance>& r)
+{
+	resource<factory<Instance>> f(r.quals());
+	f.provide([rm = r.manager()]() {
+		return factory<Instance>(rm->prebind());
+	});
+	return f;
+}
+
+
+} // end namespace cdi
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include <string>
+#include <vector>
+
+#include "cdi.hh"
+#include "factory.hh"
+
+using namespace cdi;
+using namespace std;
+
+DEFINE_QUALIFIER(Piece, int, int)
+
+
+class FactorySuite : public CxxTest::TestSuite
+{
+public:
+
+	void tearDown() {
+		providence().clear();
+	}
+
+	struct Widget {
+		string name;
+		int serial;
+		bool injected = false;
+		bool initialized = false;
+	};
+
+	void test_factory()
+	{
+		int resolved = 0;
+		resource<string> name({});
+		name.provide([&]() { ++resolved; return string("w"); });
+
+		int serial = 0;
+		resource<Widget*> widget({New});
+		widget
+			.provide([&](const string& n) { return new Widget{n, ++serial}; }, name)
+			.inject([](Widget* w, const string& n) { w->injected = (n=="w"); }, name)
+			.initialize([](Widget* w) { w->initialized = true; })
+			.dispose([](Widget* w) { delete w; });
+
+		auto f = factory_of(widget);
+		TS_ASSERT(providence().get_declared(f) != nullptr);
+		factory<Widget*> make = f.get();
+		TS_ASSERT(make);
+		TS_ASSERT_EQUALS(resolved, 1);
+
+		for(int i=1; i<=3; ++i) {
+			Widget* w = make();
+			TS_ASSERT_EQUALS(w->name, "w");
+			TS_ASSERT_EQUALS(w->serial, i);
+			TS_ASSERT(w->injected);
+			TS_ASSERT(w->initialized);
+			make.dispose(w);
+		}
+		// the dependencies were not resolved again
+		TS_ASSERT_EQUALS(resolved, 1);
+	}
+
+	void test_factory_transient_dependency()
+	{
+		// each instance gets its own New-scope dependencies, which are
+		// disposed with it
+		int made = 0, disposed = 0;
+		resource<int*> cell({New, Piece(1)});
+		cell.provide([&]() { return new int(++made); });
+		cell.dispose([&](int* p) { ++disposed; delete p; });
+
+		resource<vector<int*>*> both({New, Piece(2)});
+		both.provide([](int* a, int* b) { return new vector<int*>{a, b}; },
+			cell, cell);
+		both.dispose([](vector<int*>* v) { delete v; });
+
+		factory<vector<int*>*> make = factory_of(both).get();
+		vector<int*>* x = make();
+		vector<int*>* y = make();
+		TS_ASSERT_EQUALS(made, 4);
+		TS_ASSERT_EQUALS(*x->at(0) + *x->at(1), 3);
+		TS_ASSERT_EQUALS(*y->at(0) + *y->at(1), 7);
+
+		make.dispose(x);
+		TS_ASSERT_EQUALS(disposed, 2);
+		make.dispose(y);
+		TS_ASSERT_EQUALS(disposed, 4);
+	}
+
+	void test_factory_injection()
+	{
+		resource<int> base({});
+		base.provide([]() { return 40; });
+		resource<int> item({New});
+		int offset = 0;
+		item.provide([&](int b) { return b + (++offset); }, base);
+
+		resource<vector<int>> batch({});
+		batch.provide([](const factory<int>& f) {
+			return vector<int>{ f(), f() };
+		}, factory_of(item));
+
+		TS_ASSERT_EQUALS(batch.get(), (vector<int>{41, 42}));
+	}
+
+	void test_get_n()
+	{
+		int resolved = 0;
+		resource<string> name({});
+		name.provide([&]() { ++resolved; return string("w"); });
+
+		int serial = 0, disposed = 0;
+		resource<Widget> widget({New});
+		widget
+			.provide([&](const string& n) { return Widget{n, ++serial}; }, name)
+			.initialize([](Widget& w) { w.initialized = true; })
+			.dispose([&](Widget& w) { ++disposed; });
+
+		vector<Widget> pool;
+		providence().get_n(widget, 100, pool);
+		TS_ASSERT_EQUALS(pool.size(), 100);
+		TS_ASSERT_EQUALS(pool[99].serial, 100);
+		TS_ASSERT(pool[50].initialized);
+		TS_ASSERT_EQUALS(resolved, 1);
+
+		Widget arr[3];
+		get_n(widget, 3, arr);
+		TS_ASSERT_EQUALS(arr[2].serial, 103);
+
+		dispose_n(widget, pool.begin(), pool.end());
+		TS_ASSERT_EQUALS(disposed, 100);
+
+		// only transient resources can be made in bulk
+		vector<string> names;
+		TS_ASSERT_THROWS(get_n(name, 2, names), instantiation_error);
+
+		// on failure, the vector is left as it was
+		widget.provide([&]() -> Widget {
+			if(++serial > 105) throw std::runtime_error("full");
+			return Widget{"x", serial};
+		});
+		TS_ASSERT_THROWS(get_n(widget, 5, pool), instantiation_error);
+		TS_ASSERT_EQUALS(pool.size(), 100);
+		TS_ASSERT_EQUALS(disposed, 102);
+	}
+
+	void test_get_n_transient_dependency()
+	{
+		int made = 0, disposed = 0;
+		resource<int*> cell({New, Piece(1)});
+		cell.provide([&]() { return new int(++made); })
+		    .dispose([&](int* p) { ++disposed; delete p; });
+		resource<int**> holder({New, Piece(2)});
+		holder.provide([](int* c) { return new int*(c); }, cell)
+		      .dispose([](int** h) { delete h; });
+
+		vector<Event> seen;
+		auto sub = providence().observers().subscribe(all_events,
+			[&](const event_batch& b) {
+				for(auto& e : b)
+					if(e.manager==holder.manager()) seen.push_back(e.kind);
+			});
+
+		vector<int**> pool;
+		get_n(holder, 3, pool);
+		providence().observers().unsubscribe(sub);
+		TS_ASSERT_EQUALS(made, 3);
+		for(size_t i=0; i<3; ++i)
+			TS_ASSERT_EQUALS(*pool[i][0], int(i+1));
+		TS_ASSERT_EQUALS(seen, (vector<Event>{ Event::provided, Event::created,
+			Event::provided, Event::created, Event::provided, Event::created }));
+
+		dispose_n(holder, pool.begin(), pool.end());
+		TS_ASSERT_EQUALS(disposed, 3);
+	}
+};
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+#include "qualifiers.hh"
+
+//=================================
+//
+//  hierarchical qualifiers
+//
+//=================================
+
+namespace cdi {
+
+
+/**
+	A partial order over a set of nodes, with its transitive closure
+	precomputed.
+
+	Nodes are dense integers. The order is declared by edges from a more
+	specific node to a more general one, which must form a directed
+	acyclic graph. The closure is kept in a table of bitsets (one row of
+	ancestors per node), so that `subsumes()` is a single bit test.
+
+	Adding an edge only records it; the closure is rebuilt by the first
+	lookup after a change, under a lock, so that a batch of edges costs one
+	rebuild. Otherwise, lookups do not lock. Each new table is published
+	atomically; the replaced tables are freed as soon as no lookup is in
+	progress, so that a concurrent reader never sees a table being freed.
+  */
+class subsumption_table
+{
+public:
+	/// The node type
+	typedef uint32_t node;
+
+	subsumption_table() = default;
+	subsumption_table(const subsumption_table&) = delete;
+	subsumption_table& operator=(const subsumption_table&) = delete;
+
+	/**
+		Declare that `specific` is subsumed by `general`.
+
+		@param specific the more specific node
+		@param general the more general node
+		@throws config_error if the edge would create a cycle
+	  */
+	void add_edge(node specific, node general)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(specific==general || reaches(general, specific))
+			throw config_error(u::str_builder() << "Qualifier hierarchy edge "
+				<< specific << " -> " << general << " would create a cycle");
+
+		size_t n = std::max<size_t>(parents.size(), std::max(specific, general)+1);
+		parents.resize(n);
+		parents[specific].push_back(general);
+		stale.store(true, std::memory_order_release);
+		gen.fetch_add(1, std::memory_order_release);
+		match_memo::invalidate();
+		reclaim(0);
+	}
+
+	/**
+		Return true if `general` subsumes `specific`.
+
+		Every node subsumes itself. Nodes that appear in no edge are only
+		subsumed by themselves.
+	  */
+	inline bool subsumes(node general, node specific) const
+	{
+		if(general==specific) return true;
+		reader guard(readers);
+		const closure* cur = current.load();
+		if(stale.load(std::memory_order_acquire))
+			cur = rebuild();
+		return cur && cur->test(general, specific);
+	}
+
+	/**
+		Return the number of changes made to the table.
+
+		This can be used by indexes built over the closure to detect
+		that they are stale.
+	  */
+	inline size_t generation() const { return gen.load(std::memory_order_acquire); }
+
+	/**
+		Return the number of closure tables held, the current one and
+		those replaced but not yet freed.
+	  */
+	size_t tables_held() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return tables.size();
+	}
+
+private:
+	struct closure
+	{
+		size_t n, words;
+		std::vector<uint64_t> bits;   // row s holds the ancestors of s
+
+		inline bool test(node general, node specific) const {
+			if(general >= n || specific >= n) return false;
+			return (bits[specific*words + general/64] >> (general%64)) & 1;
+		}
+	};
+
+	// Counts a lookup in progress
+	struct reader {
+		std::atomic<size_t>& count;
+		inline reader(std::atomic<size_t>& c) : count(c) { count.fetch_add(1); }
+		inline ~reader() { count.fetch_sub(1); }
+	};
+
+	// True if `to` is `from` or one of its ancestors (with the lock held)
+	bool reaches(node from, node to) const
+	{
+		if(from >= parents.size()) return from==to;
+		std::vector<bool> seen(parents.size());
+		std::vector<node> todo { from };
+		while(! todo.empty()) {
+			node s = todo.back();
+			todo.pop_back();
+			if(s==to) return true;
+			if(s >= parents.size() || seen[s]) continue;
+			seen[s] = true;
+			todo.insert(todo.end(), parents[s].begin(), parents[s].end());
+		}
+		return false;
+	}
+
+	// Compute the closure by visiting nodes in reverse topological order
+	// (Kahn's algorithm on the reversed edges), so that the ancestors of
+	// every parent are known before its children.
+	static std::unique_ptr<closure> build(const std::vector<std::vector<node>>& parents)
+	{
+		const size_t n = parents.size();
+		auto ret = std::make_unique<closure>();
+		ret->n = n;
+		ret->words = (n+63)/64;
+		ret->bits.assign(n * ret->words, 0);
+
+		std::vector<size_t> pending(n);
+		std::vector<std::vector<node>> children(n);
+		for(node s=0; s<n; ++s) {
+			pending[s] = parents[s].size();
+			for(node p : parents[s]) children[p].push_back(s);
+		}
+
+		std::vector<node> ready;
+		for(node s=0; s<n; ++s)
+			if(pending[s]==0) ready.push_back(s);
+
+		while(! ready.empty()) {
+			node s = ready.back();
+			ready.pop_back();
+			uint64_t* row = &ret->bits[s*ret->words];
+			row[s/64] |= uint64_t(1) << (s%64);
+			for(node p : parents[s]) {
+				const uint64_t* prow = &ret->bits[p*ret->words];
+				for(size_t w=0; w < ret->words; ++w) row[w] |= prow[w];
+			}
+			for(node c : children[s])
+				if(--pending[c]==0) ready.push_back(c);
+		}
+		return ret;
+	}
+
+	// Rebuild the closure, if still stale, and publish it. The caller
+	// is a lookup in progress.
+	const closure* rebuild() const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(stale.load(std::memory_order_relaxed)) {
+			auto table = build(parents);
+			current.store(table.get());
+			tables.push_back(std::move(table));
+			stale.store(false, std::memory_order_release);
+		}
+		reclaim(1);
+		return current.load();
+	}
+
+	// Free the replaced tables, if the only lookups in progress are the
+	// caller's own (`self`); a lookup that starts later sees the current
+	// table. The lock must be held.
+	void reclaim(size_t self) const
+	{
+		if(tables.size() > 1 && readers.load()==self)
+			tables.erase(tables.begin(), tables.end()-1);
+	}
+
+	// the closure is rebuilt by lookups
+	mutable std::mutex mutex;
+	std::vector<std::vector<node>> parents;                  // guarded by mutex
+	mutable std::vector<std::unique_ptr<closure>> tables;    // guarded by mutex, the last is current
+	mutable std::atomic<const closure*> current {nullptr};
+	mutable std::atomic<bool> stale {false};
+	mutable std::atomic<size_t> readers {0};
+	std::atomic<size_t> gen {0};
+};
+
+
+/**
+	A hierarchy over the values of a qualifier type.
+
+	@tparam Value the value type of the qualifier
+
+	Each value seen by the hierarchy (in a declaration, or in the construction
+	of a qualifier) is assigned a node. The hierarchy is declared by calls to
+	`refine()`:
+	```
+	auto& regions = QUAL_CLASS(Region)::hierarchy();
+	regions.refine("eu-west", "eu");
+	regions.refine("eu-north", "eu");
+	```
+  */
+template <typename Value>
+class value_hierarchy
+{
+public:
+	typedef subsumption_table::node node;
+
+	/**
+		Return the node of a value, assigning a new node if needed.
+	  */
+	node node_of(const Value& v)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto [iter, added] = nodes.try_emplace(v, node(nodes.size()));
+		return iter->second;
+	}
+
+	/**
+		Declare that value `specific` is subsumed by value `general`.
+
+		@throws config_error if the declaration would create a cycle
+	  */
+	value_hierarchy& refine(const Value& specific, const Value& general)
+	{
+		table.add_edge(node_of(specific), node_of(general));
+		return *this;
+	}
+
+	/// Return true if node `general` subsumes node `specific`
+	inline bool subsumes(node general, node specific) const {
+		return table.subsumes(general, specific);
+	}
+
+	/// The closure table, for indexes built over the hierarchy
+	inline const subsumption_table& closure() const { return table; }
+
+private:
+	typedef detail::qual_state_traits<Value> traits;
+
+	std::mutex mutex;
+	std::unordered_map<Value, node,
+		typename traits::hasher, typename traits::equal_to> nodes;
+	subsumption_table table;
+};
+
+
+namespace detail {
+
+	// Implementation of valued hierarchical qualifiers
+	template <typename Qual, typename Value>
+	struct hier_impl : qual_state<Value>
+	{
+		typedef Qual qualifier_type;
+		typedef value_hierarchy<Value> hierarchy_type;
+
+		hier_impl(const Value& v)
+		: qual_state<Value>(u::type_id_of<qualifier_type>(), typeid(qualifier_type), v),
+		  _node(hierarchy().node_of(v))
+		{ }
+
+		/// The hierarchy of this qualifier type
+		static hierarchy_type& hierarchy() {
+			static hierarchy_type h;
+			return h;
+		}
+
+		/// The node of the value in the hierarchy
+		inline typename hierarchy_type::node node() const { return _node; }
+
+		bool matches(const qual_base& other) const override {
+			if(other.type_id()!=this->type_id()) return false;
+			return hierarchy().subsumes(_node, static_cast<const hier_impl&>(other)._node);
+		}
+
+	private:
+		const typename hierarchy_type::node _node;
+	};
+
+	// The hierarchy of tag qualifiers, whose nodes are type ids
+	inline subsumption_table& tag_table() {
+		static subsumption_table t;
+		return t;
+	}
+
+	// Implementation of tag qualifiers
+	struct tag_base : qual_base
+	{
+		using qual_base::qual_base;
+
+		bool matches(const qual_base& other) const override {
+			return tag_table().subsumes(type_id(), other.type_id());
+		}
+	};
+
+	template <typename Qual>
+	struct tag_impl : tag_base
+	{
+		typedef Qual qualifier_type;
+		tag_impl() : tag_base(u::type_id_of<qualifier_type>(), typeid(qualifier_type), 0) { }
+	};
+}
+
+
+/**
+	Declare that a tag qualifier is subsumed by another.
+
+	@param specific the more specific tag
+	@param general the more general tag
+	@throws config_error if either qualifier is not a tag, or the
+	        declaration would create a cycle
+
+	After this, `general.matches(specific)` is true, and so is matching for
+	every tag subsumed by `specific`.
+	```
+	DEFINE_TAG_QUALIFIER(Storage)
+	DEFINE_TAG_QUALIFIER(Disk)
+	refine_tag(Disk, Storage);
+	```
+  */
+inline void refine_tag(const qualifier& specific, const qualifier& general)
+{
+	if(! specific.get<detail::tag_base>() || ! general.get<detail::tag_base>())
+		throw config_error(u::str_builder() << "Cannot refine " << specific
+			<< " by " << general << ": both must be tag qualifiers");
+	detail::tag_table().add_edge(specific.type_id(), general.type_id());
+}
+
+
+/**
+	Macro to define a qualifier type whose values form a hierarchy.
+
+	A qualifier matches every qualifier whose value it subsumes; the
+	hierarchy is declared through `QUAL_CLASS(qname)::hierarchy()`.
+	@see value_hierarchy
+  */
+#define DEFINE_HIERARCHICAL_QUALIFIER(qname, qvalue_type, arg_type) \
+struct QUAL_CLASS(qname) : cdi::detail::hier_impl< QUAL_CLASS(qname), qvalue_type> { \
+	using cdi::detail::hier_impl< QUAL_CLASS(qname), qvalue_type>::hier_impl; \
+};\
+inline cdi::qualifier qname(arg_type val) { return cdi::qualifier(new QUAL_CLASS(qname)(val)); }\
+
+
+/**
+	Macro to define a tag qualifier, which can be arranged in a hierarchy
+	with other tags.
+	@see refine_tag()
+  */
+#define DEFINE_TAG_QUALIFIER(qname) \
+struct QUAL_CLASS(qname) : cdi::detail::tag_impl< QUAL_CLASS(qname) > { };\
+inline cdi::qualifier qname { new QUAL_CLASS(qname)() };\
+
+
+} // end namespace cdi
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include "cdi.hh"
+#include "hierarchy.hh"
+
+using namespace cdi;
+using namespace std;
+
+DEFINE_HIERARCHICAL_QUALIFIER(Region, string, const string&)
+DEFINE_TAG_QUALIFIER(Storage)
+DEFINE_TAG_QUALIFIER(Disk)
+DEFINE_TAG_QUALIFIER(Ssd)
+
+class HierarchySuite : public CxxTest::TestSuite
+{
+public:
+
+	void test_subsumption_table()
+	{
+		subsumption_table t;
+		TS_ASSERT(t.subsumes(3, 3));
+		TS_ASSERT(! t.subsumes(0, 1));
+
+		// 3 -> 1 -> 0, 3 -> 2 -> 0
+		t.add_edge(1, 0);
+		t.add_edge(2, 0);
+		t.add_edge(3, 1);
+		t.add_edge(3, 2);
+		TS_ASSERT(t.subsumes(0, 3));
+		TS_ASSERT(t.subsumes(1, 3));
+		TS_ASSERT(! t.subsumes(3, 0));
+		TS_ASSERT(! t.subsumes(1, 2));
+		TS_ASSERT_EQUALS(t.generation(), 4);
+
+		TS_ASSERT_THROWS(t.add_edge(0, 3), config_error);
+		TS_ASSERT_THROWS(t.add_edge(2, 2), config_error);
+		TS_ASSERT_EQUALS(t.generation(), 4);
+
+		// nodes beyond 64 span several words
+		t.add_edge(100, 3);
+		TS_ASSERT(t.subsumes(0, 100));
+		TS_ASSERT(! t.subsumes(100, 0));
+	}
+
+	void test_lazy_closure()
+	{
+		// a batch of edges is closed once, by the first lookup
+		subsumption_table t;
+		for(subsumption_table::node i=1; i<2000; ++i)
+			t.add_edge(i, i-1);
+		TS_ASSERT_EQUALS(t.tables_held(), 0);
+		TS_ASSERT(t.subsumes(0, 1999));
+		TS_ASSERT(! t.subsumes(1999, 0));
+		TS_ASSERT_EQUALS(t.tables_held(), 1);
+		TS_ASSERT_THROWS(t.add_edge(0, 1999), config_error);
+
+		// replaced tables are freed
+		for(subsumption_table::node i=2000; i<2010; ++i) {
+			t.add_edge(i, i-1);
+			TS_ASSERT(t.subsumes(0, i));
+		}
+		TS_ASSERT_EQUALS(t.tables_held(), 1);
+		TS_ASSERT_EQUALS(t.generation(), 2009);
+	}
+
+	void test_value_hierarchy()
+	{
+		QUAL_CLASS(Region)::hierarchy()
+			.refine("eu-west", "eu")
+			.refine("eu-west-1", "eu-west")
+			.refine("eu", "world");
+
+		TS_ASSERT(Region("eu").matches(Region("eu-west")));
+		TS_ASSERT(Region("world").matches(Region("eu-west-1")));
+		TS_ASSERT(Region("eu").matches(Region("eu")));
+		TS_ASSERT(! Region("eu-west").matches(Region("eu")));
+		TS_ASSERT(! Region("eu").matches(Region("us")));
+		TS_ASSERT(! Region("eu").matches(Default));
+		TS_ASSERT_THROWS(QUAL_CLASS(Region)::hierarchy().refine("world", "eu-west-1"),
+			config_error);
+
+		qualifiers general {Region("eu"), Default};
+		TS_ASSERT(general.matches({Region("eu-west-1"), Default}));
+		TS_ASSERT(! qualifiers({Region("eu-west-1"), Default}).matches(general));
+	}
+
+	void test_memo_invalidation()
+	{
+		match_memo::enable();
+		qualifiers general {Region("asia"), Default};
+		qualifiers specific {Region("jp"), Default};
+		TS_ASSERT(! general.matches(specific));
+		TS_ASSERT(! general.matches(specific));
+		QUAL_CLASS(Region)::hierarchy().refine("jp", "asia");
+		TS_ASSERT(general.matches(specific));
+		match_memo::enable(false);
+	}
+
+	void test_tag_hierarchy()
+	{
+		refine_tag(Disk, Storage);
+		refine_tag(Ssd, Disk);
+		TS_ASSERT(Storage.matches(Ssd));
+		TS_ASSERT(Disk.matches(Ssd));
+		TS_ASSERT(! Ssd.matches(Disk));
+		TS_ASSERT(! Storage.matches(Default));
+		TS_ASSERT_THROWS(refine_tag(Storage, Ssd), config_error);
+		TS_ASSERT_THROWS(refine_tag(Default, Storage), config_error);
+	}
+};
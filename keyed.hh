@@ -0,0 +1,262 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <unordered_map>
+
+#include "scope.hh"
+
+//=================================
+//
+//  keyed scopes
+//
+//=================================
+
+namespace cdi {
+
+
+/**
+	Implementation of scopes which hold one context per runtime key.
+
+	@tparam Tag For each different type, a new scope class is defined.
+	@tparam Key the key type, e.g., a tenant or session id
+	@tparam Hash the hash function of keys
+
+	A key is activated for the current thread by an instance of this class,
+	constructed on the stack, as with `LocalScope`:
+	```
+	struct TenantScope : KeyedScope<TenantScope, int> {
+		using KeyedScope::KeyedScope;
+	};
+	inline qualifier Tenant { new scope_proxy<TenantScope> };
+
+	{
+		TenantScope guard(tenant_id);
+		db.get();   // the instance of this tenant
+	}
+	```
+	Guards may be nested, for the same or for different keys. The context
+	of a key is created when the key is first activated, and survives its
+	guards, until the key is evicted, either explicitly by `evict()`, by
+	`evict_idle()`, or because the number of keys exceeds the capacity set
+	by `set_capacity()`, in which case the least recently used keys are
+	evicted. Evicting a key disposes all its instances. Keys that are active
+	in some thread are never evicted.
+
+	The map of keys is shared by all threads, and is protected by a mutex,
+	which is only taken by the guards and the eviction calls. Since a
+	context must not be used by two threads at once, a key can be active in
+	only one thread at a time: activating it while it is active in another
+	thread throws `config_error`.
+  */
+template <typename Tag, typename Key, typename Hash = std::hash<Key>>
+class KeyedScope
+{
+public:
+	/// The key type
+	typedef Key key_type;
+
+	/// The clock used for idle timeouts
+	typedef std::chrono::steady_clock clock;
+
+	/**
+		Activate a key for the current thread, creating its context if needed.
+		@throws config_error if the key is active in another thread
+	  */
+	explicit KeyedScope(const Key& key)
+	: saved(current)
+	{
+		std::unique_ptr<context> evicted;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto [iter, isnew] = keys.try_emplace(key);
+			entry& e = iter->second;
+			if(e.users > 0 && e.owner != std::this_thread::get_id())
+				throw config_error(u::str_builder() << "A key of "
+					<< u::demangle(typeid(Tag).name()) << " is already active in another thread");
+			if(isnew) {
+				e.ctx = std::make_unique<context>();
+				e.key = &iter->first;
+				e.pos = lru.insert(lru.begin(), &e);
+			} else
+				lru.splice(lru.begin(), lru, e.pos);
+			++ e.users;
+			e.owner = std::this_thread::get_id();
+			current = &e;
+			if(isnew) evict_over_capacity(evicted);
+		}
+		evicted.reset();
+		detail::scope_event<Tag>(Event::scope_activated);
+	}
+
+	~KeyedScope()
+	{
+		assert(current != nullptr);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			-- current->users;
+			current->last_used = clock::now();
+		}
+		current = saved;
+		try {
+			detail::scope_event<Tag>(Event::scope_deactivated);
+		} catch(...) { }
+	}
+
+	KeyedScope(const KeyedScope&) = delete;
+	KeyedScope& operator=(const KeyedScope&) = delete;
+
+	static inline std::tuple<asset*, bool> get_asset(const resourceid& rid)
+	{
+		if(! is_active()) throw inactive_scope_error(u::str_builder()
+			<< "Trying to allocate " << rid << " while scope is inactive");
+		return current->ctx->get(rid);
+	}
+
+	static inline void drop_asset(const resourceid& rid)
+	{
+		if(! is_active()) throw inactive_scope_error(u::str_builder()
+			<< "Trying to drop " << rid << " while scope is inactive");
+		current->ctx->drop(rid);
+	}
+
+	/**
+		Returns true if a key is active in the current thread
+	  */
+	static inline bool is_active() { return current!=nullptr; }
+
+	/**
+		Return the key active in the current thread.
+		@throws inactive_scope_error if no key is active
+	  */
+	static const Key& key() {
+		if(! is_active()) throw inactive_scope_error(u::str_builder()
+			<< "No key is active in " << u::demangle(typeid(Tag).name()));
+		return *current->key;
+	}
+
+	/** Return the number of keys with a context */
+	static size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return keys.size();
+	}
+
+	/** Return true if a key has a context */
+	static bool contains(const Key& key) {
+		std::lock_guard<std::mutex> lock(mutex);
+		return keys.count(key) > 0;
+	}
+
+	/**
+		Evict a key, disposing all its instances.
+
+		@return true if the key was evicted, false if it has no context,
+		or it is active in some thread
+	  */
+	static bool evict(const Key& key)
+	{
+		std::unique_ptr<context> evicted;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto iter = keys.find(key);
+			if(iter==keys.end() || iter->second.users > 0) return false;
+			evicted = remove(iter);
+		}
+		return true;  // the context is disposed here, without the lock
+	}
+
+	/**
+		Evict the keys that have not been active for some time.
+
+		@param idle the idle time after which a key is evicted
+		@return the number of keys evicted
+	  */
+	static size_t evict_idle(clock::duration idle) {
+		return evict_released_before(clock::now() - idle);
+	}
+
+	/**
+		Evict all keys that are not active.
+		@return the number of keys evicted
+	  */
+	static size_t clear() { return evict_released_before(clock::time_point::max()); }
+
+	/**
+		Set the maximum number of keys with a context.
+
+		When a new key is activated and the capacity is exceeded, the least
+		recently used keys that are not active are evicted.
+		@param n the capacity, or 0 for no limit (the default)
+	  */
+	static void set_capacity(size_t n) {
+		std::lock_guard<std::mutex> lock(mutex);
+		capacity = n;
+	}
+
+	/** Return the maximum number of keys, or 0 if there is no limit */
+	static size_t get_capacity() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return capacity;
+	}
+
+private:
+	struct entry {
+		std::unique_ptr<context> ctx;
+		const Key* key = nullptr;
+		size_t users = 0;
+		std::thread::id owner;  // the thread of the users
+		clock::time_point last_used;
+		typename std::list<entry*>::iterator pos;
+	};
+
+	typedef std::unordered_map<Key, entry, Hash> key_map;
+
+	// remove an entry, returning its context, to be disposed without the lock
+	static std::unique_ptr<context> remove(typename key_map::iterator iter)
+	{
+		std::unique_ptr<context> ret = std::move(iter->second.ctx);
+		lru.erase(iter->second.pos);
+		keys.erase(iter);
+		return ret;
+	}
+
+	static size_t evict_released_before(clock::time_point deadline)
+	{
+		std::vector<std::unique_ptr<context>> evicted;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for(auto pos = lru.begin(); pos != lru.end(); ) {
+				entry& e = **pos++;
+				if(e.users == 0 && e.last_used < deadline)
+					evicted.push_back(remove(keys.find(*e.key)));
+			}
+		}
+		return evicted.size();  // the contexts are disposed here, without the lock
+	}
+
+	// evict the least recently used key that is not active, if over capacity
+	static void evict_over_capacity(std::unique_ptr<context>& evicted)
+	{
+		if(capacity==0 || keys.size() <= capacity) return;
+		for(auto pos = lru.rbegin(); pos != lru.rend(); ++pos)
+			if((*pos)->users == 0) {
+				evicted = remove(keys.find(*(*pos)->key));
+				return;
+			}
+	}
+
+	entry* saved;
+
+	static inline std::mutex mutex;
+	static inline key_map keys;                // guarded by mutex
+	static inline std::list<entry*> lru;       // guarded by mutex, most recent first
+	static inline size_t capacity = 0;         // guarded by mutex
+	static inline thread_local entry* current; // zero-initialized
+};
+
+
+} // end namespace cdi
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include <atomic>
+#include <thread>
+
+#include "cdi.hh"
+#include "keyed.hh"
+
+using namespace cdi;
+using namespace std;
+
+class KeyedSuite : public CxxTest::TestSuite
+{
+public:
+
+	struct TenantScope : KeyedScope<TenantScope, string> {
+		using KeyedScope::KeyedScope;
+	};
+	static inline qualifier Tenant { new scope_proxy<TenantScope> };
+
+	void tearDown() {
+		TenantScope::set_capacity(0);
+		TenantScope::clear();
+		providence().clear();
+	}
+
+	void test_per_key_instances()
+	{
+		int made = 0, disposed = 0;
+		resource<string> r({Tenant});
+		r.provide([&]() { ++made; return TenantScope::key() + "-db"; })
+		 .dispose([&](string&) { ++disposed; });
+
+		TS_ASSERT(! TenantScope::is_active());
+		TS_ASSERT_THROWS(r.get(), inactive_scope_error);
+		{
+			TenantScope a("a");
+			TS_ASSERT_EQUALS(r.get(), "a-db");
+			{
+				TenantScope b("b");
+				TS_ASSERT_EQUALS(r.get(), "b-db");
+				TS_ASSERT_EQUALS(TenantScope::key(), "b");
+			}
+			TS_ASSERT_EQUALS(r.get(), "a-db");
+		}
+		// contexts survive their guards
+		{
+			TenantScope a("a");
+			TS_ASSERT_EQUALS(r.get(), "a-db");
+		}
+		TS_ASSERT_EQUALS(made, 2);
+		TS_ASSERT_EQUALS(TenantScope::size(), 2);
+
+		// keys are evicted one by one, disposing their instances
+		TS_ASSERT(TenantScope::evict("a"));
+		TS_ASSERT(! TenantScope::evict("a"));
+		TS_ASSERT_EQUALS(disposed, 1);
+		TS_ASSERT(TenantScope::contains("b"));
+		TS_ASSERT(! TenantScope::contains("a"));
+
+		// active keys are not evicted
+		{
+			TenantScope b("b");
+			TS_ASSERT(! TenantScope::evict("b"));
+			TS_ASSERT_EQUALS(TenantScope::clear(), 0);
+		}
+		TS_ASSERT_EQUALS(TenantScope::clear(), 1);
+		TS_ASSERT_EQUALS(disposed, 2);
+	}
+
+	void test_idle_and_lru_eviction()
+	{
+		resource<string> r({Tenant});
+		r.provide([]() { return TenantScope::key(); });
+
+		{ TenantScope a("a"); r.get(); }
+		this_thread::sleep_for(chrono::milliseconds(20));
+		{ TenantScope b("b"); r.get(); }
+		TS_ASSERT_EQUALS(TenantScope::evict_idle(chrono::milliseconds(10)), 1);
+		TS_ASSERT(TenantScope::contains("b"));
+
+		TenantScope::set_capacity(2);
+		{ TenantScope c("c"); }
+		{ TenantScope b("b"); }
+		{ TenantScope d("d"); }   // evicts c, the least recently used
+		TS_ASSERT_EQUALS(TenantScope::size(), 2);
+		TS_ASSERT(TenantScope::contains("b"));
+		TS_ASSERT(! TenantScope::contains("c"));
+
+		// the capacity may be exceeded by active keys
+		TenantScope b("b"), d("d"), e("e");
+		TS_ASSERT_EQUALS(TenantScope::size(), 3);
+	}
+
+	void test_threads()
+	{
+		resource<string> r({Tenant});
+		r.provide([]() { return TenantScope::key(); });
+
+		vector<thread> threads;
+		vector<string> seen(4);
+		for(int i=0; i<4; ++i)
+			threads.emplace_back([&, i]() {
+				TenantScope guard(to_string(i));
+				seen[i] = r.get();
+			});
+		for(auto& t : threads) t.join();
+		for(int i=0; i<4; ++i)
+			TS_ASSERT_EQUALS(seen[i], to_string(i));
+		TS_ASSERT_EQUALS(TenantScope::size(), 4);
+		TS_ASSERT(! TenantScope::is_active());
+
+		// a key is active in one thread at a time
+		atomic<bool> holding {false}, release {false};
+		thread holder([&]() {
+			TenantScope guard("0");
+			holding = true;
+			while(! release) this_thread::yield();
+		});
+		while(! holding) this_thread::yield();
+		TS_ASSERT_THROWS(TenantScope("0"), config_error);
+		TS_ASSERT(! TenantScope::is_active());
+		{
+			TenantScope other("1");
+			TS_ASSERT_EQUALS(r.get(), "1");
+		}
+		release = true;
+		holder.join();
+		TenantScope again("0");
+		TS_ASSERT_EQUALS(r.get(), "0");
+	}
+};
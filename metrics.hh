@@ -0,0 +1,423 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <memory>
+#include <thread>
+#include <string>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <csignal>
+#include <semaphore.h>
+
+#include "scope.hh"
+
+//=================================
+//
+//  runtime metrics
+//
+//=================================
+
+namespace cdi {
+
+
+/**
+	Collects runtime statistics of the container and renders them as
+	Prometheus exposition text.
+
+	A collector subscribes to the container's lifecycle observers and
+	keeps, for each scope class, atomic counters of instantiations,
+	disposals and provider failures, and the number of live assets.
+	When provider timing is enabled, a latency histogram of providers
+	is kept as well.
+	```
+	metrics_collector metrics(true);   // with latency histograms
+	...
+	metrics.render(std::cout);
+	```
+	The counters are updated by the observer callbacks, at the points
+	where the container flushes events. Rendering only reads them, so it
+	can be done from any thread, without stopping resolution.
+
+	Note that `container::clear()` drops all observers; a collector stops
+	receiving events after that.
+  */
+class metrics_collector
+{
+public:
+	/// Number of histogram buckets (excluding `+Inf`)
+	static constexpr size_t nbuckets = 8;
+
+	/// Upper bounds of the latency histogram buckets, in seconds
+	static constexpr double bucket_bounds[nbuckets] = {
+		1e-6, 1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1.0, 10.0
+	};
+
+	/**
+		Create a collector and subscribe it to the container.
+		@param histograms if true, provider timing is enabled in the container,
+		       until the collector is destroyed
+	  */
+	explicit metrics_collector(bool histograms = false)
+		: timed(histograms), epoch(providence().epoch())
+	{
+		lifecycle_observers& obs = providence().observers();
+		was_timing = obs.timing();
+		if(timed) obs.set_timing(true);
+		sub = obs.subscribe(asset_events,
+			[this](const event_batch& batch) { record(batch); });
+	}
+
+	~metrics_collector()
+	{
+		// after container::clear(), the observers are reset already
+		if(providence().epoch()!=epoch) return;
+		lifecycle_observers& obs = providence().observers();
+		try {
+			obs.unsubscribe(sub);
+		} catch(...) { }
+		if(timed) obs.set_timing(was_timing);
+	}
+
+	metrics_collector(const metrics_collector&) = delete;
+	metrics_collector& operator=(const metrics_collector&) = delete;
+
+	/**
+		Write the metrics to a stream, in Prometheus text format.
+	  */
+	void render(std::ostream& out) const
+	{
+		// take a snapshot of the slot list; the values are read atomically
+		std::vector<const scope_slot*> slots;
+		{
+			std::lock_guard<std::mutex> lock(slots_mutex);
+			for(auto& [name, slot] : by_name)
+				slots.push_back(slot);
+		}
+
+		header(out, "cdi_managers_declared", "gauge",
+			"Number of declared resources.");
+		out << "cdi_managers_declared " << providence().declared() << '\n';
+
+		header(out, "cdi_assets_live", "gauge",
+			"Number of resource instances held by each scope.");
+		for(auto slot : slots)
+			if(slot->holds_assets)
+				out << "cdi_assets_live{scope=\"" << slot->label << "\"} "
+					<< load(slot->provided) - load(slot->disposed) << '\n';
+
+		counter(out, slots, "cdi_instantiations_total",
+			"Number of resource instances created.", &scope_slot::created);
+		counter(out, slots, "cdi_disposals_total",
+			"Number of resource instances disposed.", &scope_slot::disposed);
+		counter(out, slots, "cdi_instantiation_failures_total",
+			"Number of provider invocations that threw.", &scope_slot::failed);
+
+		if(reclaimer::enabled()) {
+			auto rs = reclaimer::stats();
+			header(out, "cdi_reclaim_queue_length", "gauge",
+				"Number of retired contexts waiting to be disposed.");
+			out << "cdi_reclaim_queue_length " << rs.queued << '\n';
+			header(out, "cdi_reclaim_lag_seconds", "gauge",
+				"Time from retirement to disposal of the last reclaimed context.");
+			out << "cdi_reclaim_lag_seconds " << std::chrono::duration<double>(rs.last_lag).count() << '\n';
+			header(out, "cdi_reclaim_lag_max_seconds", "gauge",
+				"Maximum time from retirement to disposal of a context.");
+			out << "cdi_reclaim_lag_max_seconds " << std::chrono::duration<double>(rs.max_lag).count() << '\n';
+			header(out, "cdi_reclaimed_contexts_total", "counter",
+				"Number of contexts disposed in the background.");
+			out << "cdi_reclaimed_contexts_total " << rs.reclaimed << '\n';
+		}
+
+		if(! timed) return;
+		header(out, "cdi_provider_duration_seconds", "histogram",
+			"Time spent in resource providers.");
+		for(auto slot : slots) {
+			uint64_t cumulative = 0;
+			for(size_t i=0; i < nbuckets; ++i) {
+				cumulative += load(slot->buckets[i]);
+				out << "cdi_provider_duration_seconds_bucket{scope=\"" << slot->label
+					<< "\",le=\"" << bucket_bounds[i] << "\"} " << cumulative << '\n';
+			}
+			uint64_t count = cumulative + load(slot->buckets[nbuckets]);
+			out << "cdi_provider_duration_seconds_bucket{scope=\"" << slot->label
+				<< "\",le=\"+Inf\"} " << count << '\n';
+			out << "cdi_provider_duration_seconds_sum{scope=\"" << slot->label << "\"} "
+				<< load(slot->nanos) * 1e-9 << '\n';
+			out << "cdi_provider_duration_seconds_count{scope=\"" << slot->label << "\"} "
+				<< count << '\n';
+		}
+	}
+
+	/** Return the metrics as a string, in Prometheus text format */
+	std::string text() const
+	{
+		std::ostringstream out;
+		render(out);
+		return out.str();
+	}
+
+	/**
+		Write the metrics to a file.
+
+		The text is written to a temporary file which is then renamed,
+		so that a reader never sees a partial file.
+		@param path the file to (over)write
+		@return true on success
+	  */
+	bool write_file(const std::string& path) const
+	{
+		std::string tmp = path + ".tmp";
+		{
+			std::ofstream out(tmp, std::ios::trunc);
+			if(! out) return false;
+			render(out);
+			out.flush();
+			if(! out) {
+				std::remove(tmp.c_str());
+				return false;
+			}
+		}
+		if(std::rename(tmp.c_str(), path.c_str())!=0) {
+			std::remove(tmp.c_str());
+			return false;
+		}
+		return true;
+	}
+
+private:
+	typedef std::atomic<uint64_t> counter_t;
+
+	struct scope_slot
+	{
+		std::string label;
+		bool holds_assets;
+		counter_t provided {0}, created {0}, disposed {0}, failed {0};
+		counter_t nanos {0};
+		counter_t buckets[nbuckets+1] {};
+	};
+
+	static inline uint64_t load(const counter_t& c)
+	{ return c.load(std::memory_order_relaxed); }
+
+	static inline void bump(counter_t& c, uint64_t n = 1)
+	{ c.fetch_add(n, std::memory_order_relaxed); }
+
+	// Called by the container's event delivery (a single thread)
+	void record(const event_batch& batch)
+	{
+		for(auto& ev : batch) {
+			scope_slot& slot = slot_for(ev.scope);
+			switch(ev.kind) {
+			case Event::provided:
+				bump(slot.provided);
+				observe(slot, ev.elapsed);
+				break;
+			case Event::created:
+				bump(slot.created);
+				break;
+			case Event::disposed:
+				bump(slot.disposed);
+				break;
+			case Event::failed:
+				bump(slot.failed);
+				observe(slot, ev.elapsed);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	void observe(scope_slot& slot, std::chrono::nanoseconds elapsed)
+	{
+		if(! timed) return;
+		double secs = elapsed.count() * 1e-9;
+		size_t b = 0;
+		while(b < nbuckets && secs > bucket_bounds[b]) ++b;
+		bump(slot.buckets[b]);
+		bump(slot.nanos, elapsed.count());
+	}
+
+	// Only the recording thread inserts slots, so lookups need no lock
+	scope_slot& slot_for(std::type_index scope)
+	{
+		auto iter = by_type.find(scope);
+		if(iter!=by_type.end())
+			return *iter->second;
+
+		auto slot = std::make_unique<scope_slot>();
+		slot->label = escape(u::demangle(scope.name()));
+		// NewScope assets are never held, hence never disposed
+		slot->holds_assets = (scope != typeid(NewScope));
+		scope_slot* ret = slot.get();
+
+		std::lock_guard<std::mutex> lock(slots_mutex);
+		by_type.emplace(scope, std::move(slot));
+		by_name.emplace(ret->label, ret);
+		return *ret;
+	}
+
+	static std::string escape(const std::string& value)
+	{
+		std::string ret;
+		for(char c : value) {
+			if(c=='\\' || c=='"') { ret += '\\'; ret += c; }
+			else if(c=='\n') ret += "\\n";
+			else ret += c;
+		}
+		return ret;
+	}
+
+	static void header(std::ostream& out, const char* name, const char* type,
+		const char* help)
+	{
+		out << "# HELP " << name << ' ' << help << '\n'
+			<< "# TYPE " << name << ' ' << type << '\n';
+	}
+
+	static void counter(std::ostream& out, const std::vector<const scope_slot*>& slots,
+		const char* name, const char* help, counter_t scope_slot::* field)
+	{
+		header(out, name, "counter", help);
+		for(auto slot : slots)
+			out << name << "{scope=\"" << slot->label << "\"} "
+				<< load(slot->*field) << '\n';
+	}
+
+	bool timed;
+	bool was_timing;            // the timing state to restore
+	const size_t epoch;         // of the container, when subscribed
+	lifecycle_observers::subscription sub;
+
+	mutable std::mutex slots_mutex;
+	std::unordered_map<std::type_index, std::unique_ptr<scope_slot>> by_type;
+	std::map<std::string, const scope_slot*> by_name;  // sorted, for rendering
+};
+
+
+
+/**
+	Writes the metrics of a collector to a file, from a background thread,
+	whenever it is triggered.
+
+	The exporter can be triggered by a call to `trigger()`, or by a signal,
+	after `install_handler()` has been called:
+	```
+	metrics_collector metrics;
+	metrics_exporter exporter(metrics, "/var/run/myapp.prom");
+	exporter.install_handler(SIGUSR2);
+	```
+	The signal handler only posts a semaphore (which is async-signal-safe);
+	the rendering happens in the exporter thread. Only one exporter can
+	have a signal handler installed at a time.
+  */
+class metrics_exporter
+{
+public:
+	/**
+		Start the exporter thread.
+		@param m the collector to export
+		@param path the file written on each trigger
+	  */
+	metrics_exporter(const metrics_collector& m, const std::string& path)
+		: metrics(m), path(path)
+	{
+		if(sem_init(&wakeup, 0, 0)!=0)
+			throw config_error("Could not initialize the metrics exporter semaphore");
+		worker = std::thread([this]() { run(); });
+	}
+
+	/**
+		Stop the exporter thread, restoring the previous signal handler.
+	  */
+	~metrics_exporter()
+	{
+		remove_handler();
+		stopping.store(true);
+		sem_post(&wakeup);
+		worker.join();
+		sem_destroy(&wakeup);
+	}
+
+	metrics_exporter(const metrics_exporter&) = delete;
+	metrics_exporter& operator=(const metrics_exporter&) = delete;
+
+	/** Request an export; this is async-signal-safe */
+	inline void trigger() { sem_post(&wakeup); }
+
+	/**
+		Install a handler for the given signal, which triggers an export.
+		@throws config_error if another exporter has installed a handler
+	  */
+	void install_handler(int signo = SIGUSR2)
+	{
+		metrics_exporter* expected = nullptr;
+		if(! active.compare_exchange_strong(expected, this))
+			throw config_error("A metrics exporter signal handler is already installed");
+
+		struct sigaction sa {};
+		sa.sa_handler = &metrics_exporter::on_signal;
+		sigemptyset(&sa.sa_mask);
+		sa.sa_flags = SA_RESTART;
+		if(sigaction(signo, &sa, &saved_action)!=0) {
+			active.store(nullptr);
+			throw config_error(u::str_builder()
+				<< "Could not install a handler for signal " << signo);
+		}
+		installed = signo;
+	}
+
+	/** Remove the signal handler, if installed */
+	void remove_handler()
+	{
+		if(installed==0) return;
+		sigaction(installed, &saved_action, nullptr);
+		installed = 0;
+		active.store(nullptr);
+	}
+
+	/** Return the number of exports written so far */
+	inline size_t exports() const { return written.load(); }
+
+	/** Return the number of exports that failed */
+	inline size_t failures() const { return failed.load(); }
+
+private:
+	static void on_signal(int)
+	{
+		metrics_exporter* e = active.load();
+		if(e) sem_post(&e->wakeup);
+	}
+
+	void run()
+	{
+		while(true) {
+			while(sem_wait(&wakeup)!=0) { } // EINTR
+			if(stopping.load()) return;
+			try {
+				if(metrics.write_file(path)) ++written;
+				else ++failed;
+			} catch(...) {
+				++failed;
+			}
+		}
+	}
+
+	const metrics_collector& metrics;
+	const std::string path;
+
+	sem_t wakeup;
+	std::thread worker;
+	std::atomic<bool> stopping {false};
+	std::atomic<size_t> written {0}, failed {0};
+
+	int installed = 0;
+	struct sigaction saved_action {};
+	static inline std::atomic<metrics_exporter*> active {nullptr};
+};
+
+
+} // end namespace cdi
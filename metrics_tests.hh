@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include <fstream>
+#include <chrono>
+#include <thread>
+
+#include "cdi.hh"
+#include "metrics.hh"
+
+using namespace cdi;
+using namespace std;
+
+DEFINE_VOID_QUALIFIER(Faulty)
+
+class MetricsSuite : public CxxTest::TestSuite
+{
+public:
+
+	void tearDown() {
+		providence().clear();
+	}
+
+	struct MetScope : LocalScope<MetScope> { };
+	static inline qualifier Met { new scope_proxy<MetScope> };
+
+	static bool has_line(const string& text, const string& line) {
+		return text.find("\n" + line + "\n") != string::npos;
+	}
+
+	void test_render_counters()
+	{
+		metrics_collector metrics;
+
+		resource<int> r({Met});
+		r.provide([]() { return 3; });
+		resource<int> bad({Met, Faulty});
+		bad.provide([]() -> int { throw std::runtime_error("no"); });
+
+		{
+			MetScope scope;
+			r.get();
+			TS_ASSERT_THROWS(bad.get(), instantiation_error);
+			r.get();
+			string text = metrics.text();
+			TS_ASSERT(has_line(text, "cdi_managers_declared 2"));
+			TS_ASSERT(has_line(text,
+				"cdi_assets_live{scope=\"MetricsSuite::MetScope\"} 1"));
+			TS_ASSERT(text.find("cdi_provider_duration") == string::npos);
+		}
+		string text = metrics.text();
+		TS_ASSERT(has_line(text, "# TYPE cdi_instantiations_total counter"));
+		TS_ASSERT(has_line(text,
+			"cdi_instantiations_total{scope=\"MetricsSuite::MetScope\"} 1"));
+		TS_ASSERT(has_line(text,
+			"cdi_disposals_total{scope=\"MetricsSuite::MetScope\"} 1"));
+		TS_ASSERT(has_line(text,
+			"cdi_instantiation_failures_total{scope=\"MetricsSuite::MetScope\"} 1"));
+		TS_ASSERT(has_line(text,
+			"cdi_assets_live{scope=\"MetricsSuite::MetScope\"} 0"));
+	}
+
+	void test_render_reclaimer()
+	{
+		metrics_collector metrics;
+		TS_ASSERT(metrics.text().find("cdi_reclaim") == string::npos);
+
+		reclaimer::enable();
+		resource<int> r({Met});
+		r.provide([]() { return 3; }).dispose([](int&) { });
+		{
+			MetScope scope;
+			r.get();
+		}
+		reclaimer::drain();
+		string text = metrics.text();
+		reclaimer::enable(false);
+		TS_ASSERT(has_line(text, "cdi_reclaim_queue_length 0"));
+		TS_ASSERT(has_line(text, "# TYPE cdi_reclaim_lag_seconds gauge"));
+		TS_ASSERT(text.find("\ncdi_reclaimed_contexts_total ") != string::npos);
+	}
+
+	void test_render_histogram()
+	{
+		{
+			// timing is restored when the collector is destroyed
+			metrics_collector metrics(true);
+			TS_ASSERT(providence().observers().timing());
+		}
+		TS_ASSERT(! providence().observers().timing());
+
+		metrics_collector metrics(true);
+		TS_ASSERT(providence().observers().timing());
+
+		resource<int> r({New});
+		r.provide([]() { return 1; });
+		for(int i=0; i<5; ++i) r.get();
+
+		string text = metrics.text();
+		TS_ASSERT(has_line(text, "# TYPE cdi_provider_duration_seconds histogram"));
+		TS_ASSERT(has_line(text,
+			"cdi_provider_duration_seconds_bucket{scope=\"cdi::NewScope\",le=\"+Inf\"} 5"));
+		TS_ASSERT(has_line(text,
+			"cdi_provider_duration_seconds_count{scope=\"cdi::NewScope\"} 5"));
+		// assets of NewScope are not held
+		TS_ASSERT(text.find("cdi_assets_live{scope=\"cdi::NewScope\"}") == string::npos);
+	}
+
+	void test_export_on_signal()
+	{
+		metrics_collector metrics;
+		resource<int> r({});
+		r.provide([]() { return 1; });
+		r.get();
+
+		string path = "metrics_tests.prom";
+		{
+			metrics_exporter exporter(metrics, path);
+			exporter.install_handler(SIGUSR2);
+			TS_ASSERT_THROWS(metrics_exporter(metrics, path).install_handler(SIGUSR2),
+				config_error);
+
+			std::raise(SIGUSR2);
+			for(int i=0; i<1000 && exporter.exports()==0; ++i)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			TS_ASSERT_EQUALS(exporter.exports(), 1);
+		}
+
+		ifstream in(path);
+		string text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+		TS_ASSERT(has_line(text,
+			"cdi_instantiations_total{scope=\"cdi::GlobalScope\"} 1"));
+		std::remove(path.c_str());
+	}
+};
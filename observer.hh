@@ -0,0 +1,228 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <typeindex>
+#include <chrono>
+
+#include "contextual.hh"
+
+//=================================
+//
+//  lifecycle observers
+//
+//=================================
+
+namespace cdi {
+
+/**
+	These labels denote the lifecycle events reported to observers.
+  */
+enum class Event : unsigned {
+	provided,           //< an asset received a value from its provider
+	created,            //< an asset reached `Phase::created`
+	disposed,           //< an asset was disposed
+	scope_activated,    //< a scope became active
+	scope_deactivated,  //< a scope became inactive
+	failed,             //< the provider of an asset threw
+	claimed             //< a speculative instance was got for the first time
+};
+
+/// Return the bit representing an event kind in an event mask
+constexpr unsigned event_bit(Event e) { return 1u << unsigned(e); }
+
+/// Event mask for the asset events
+constexpr unsigned asset_events = event_bit(Event::provided)
+	| event_bit(Event::created) | event_bit(Event::disposed)
+	| event_bit(Event::failed) | event_bit(Event::claimed);
+
+/// Event mask for the scope events
+constexpr unsigned scope_events = event_bit(Event::scope_activated)
+	| event_bit(Event::scope_deactivated);
+
+/// Event mask for all events
+constexpr unsigned all_events = asset_events | scope_events;
+
+
+/**
+	A lifecycle event, as delivered to observers.
+
+	For asset events, `manager` is the resource manager of the asset and `scope`
+	is the class of the scope holding the asset. For scope events, `manager` is null.
+
+	For `provided` and `failed` events, `elapsed` is the time spent in the
+	provider, when timing is enabled (see `lifecycle_observers::set_timing()`),
+	and zero otherwise.
+  */
+struct lifecycle_event
+{
+	Event kind;
+	const contextual_base* manager;
+	std::type_index scope;
+	std::chrono::nanoseconds elapsed {0};
+};
+
+/// A batch of events, in the order they happened
+typedef std::vector<lifecycle_event> event_batch;
+
+/// The callable type of observers
+typedef std::function<void(const event_batch&)> event_handler;
+
+
+/**
+	A registry of observers for lifecycle events.
+
+	Observers subscribe with a mask of the events they are interested in.
+	The union of all subscription masks is kept in a single flag word, so that
+	instrumented code paths can skip all event handling with one test, when
+	nobody is subscribed:
+	```
+	if(obs.observing(Event::created))
+		obs.notify(Event::created, rm, scope);
+	```
+
+	Events are not delivered one by one; they are buffered and handed to
+	each subscriber in batches, when the buffer fills up or on `flush()`.
+	The container flushes at quiescent points (when an instantiation has
+	completed, when a context has been cleared and when a scope is deactivated).
+	A subscriber only receives the events in its mask.
+  */
+class lifecycle_observers
+{
+public:
+	/// Subscription handle, used to unsubscribe
+	typedef size_t subscription;
+
+	/**
+		Add an observer.
+		@param mask the events of interest, e.g. `event_bit(Event::created)`
+		@param handler the callable receiving batches of events
+		@return a handle for `unsubscribe()`
+	  */
+	subscription subscribe(unsigned mask, event_handler handler)
+	{
+		subs.push_back({ ++last_id, mask & all_events, std::move(handler) });
+		flags |= subs.back().mask;
+		return last_id;
+	}
+
+	/**
+		Remove an observer. Buffered events are flushed first.
+		@param s the handle returned by `subscribe()`
+	  */
+	void unsubscribe(subscription s)
+	{
+		flush();
+		subs.erase(std::remove_if(subs.begin(), subs.end(),
+			[s](const subscriber& sub) { return sub.id==s; }), subs.end());
+		flags = 0;
+		for(auto& sub : subs) flags |= sub.mask;
+	}
+
+	/** Return true if any event in `mask` has subscribers */
+	inline bool observing(unsigned mask = all_events) const { return (flags & mask)!=0; }
+
+	/** Return true if event `e` has subscribers */
+	inline bool observing(Event e) const { return observing(event_bit(e)); }
+
+	/**
+		Enable or disable the timing of providers.
+
+		Timing costs two clock reads per instantiation, so it is off by default.
+	  */
+	inline void set_timing(bool on) { timed = on; }
+
+	/** Return true if providers are timed */
+	inline bool timing() const { return timed; }
+
+	/**
+		Record an event for delivery.
+
+		This is meant to be called only after `observing(e)` returned true.
+	  */
+	inline void notify(Event e, const contextual_base* rm, std::type_index scope,
+		std::chrono::nanoseconds elapsed = {})
+	{
+		buffer.push_back({e, rm, scope, elapsed});
+		kinds |= event_bit(e);
+		if(buffer.size() >= batch_size)
+			flush();
+	}
+
+	/**
+		Deliver all buffered events to subscribers.
+
+		Events generated by the subscribers themselves are delivered in a
+		subsequent batch.
+	  */
+	void flush()
+	{
+		if(flushing) return;
+		flushing = true;
+		try {
+			while(! buffer.empty()) {
+				event_batch batch;
+				batch.swap(buffer);
+				unsigned batch_kinds = kinds;
+				kinds = 0;
+				deliver(batch, batch_kinds);
+			}
+		} catch(...) {
+			flushing = false;
+			throw;
+		}
+		flushing = false;
+	}
+
+	/** Return the number of buffered (undelivered) events */
+	inline size_t pending() const { return buffer.size(); }
+
+	/** Remove all subscribers, discarding buffered events */
+	void clear()
+	{
+		subs.clear();
+		buffer.clear();
+		flags = kinds = 0;
+		timed = false;
+	}
+
+	/** Maximum number of buffered events before an automatic flush */
+	size_t batch_size = 256;
+
+private:
+	struct subscriber {
+		subscription id;
+		unsigned mask;
+		event_handler handler;
+	};
+
+	void deliver(const event_batch& batch, unsigned batch_kinds)
+	{
+		// handlers may (un)subscribe, so iterate over a copy
+		std::vector<subscriber> targets = subs;
+		event_batch filtered;
+		for(auto& sub : targets) {
+			if((sub.mask & batch_kinds)==0) continue;
+			if((sub.mask & batch_kinds)==batch_kinds) {
+				sub.handler(batch);
+				continue;
+			}
+			filtered.clear();
+			for(auto& ev : batch)
+				if(sub.mask & event_bit(ev.kind)) filtered.push_back(ev);
+			sub.handler(filtered);
+		}
+	}
+
+	unsigned flags = 0;  // union of subscriber masks
+	unsigned kinds = 0;  // union of buffered event kinds
+	bool flushing = false;
+	bool timed = false;
+	subscription last_id = 0;
+	std::vector<subscriber> subs;
+	event_batch buffer;
+};
+
+
+} // end namespace cdi
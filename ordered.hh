@@ -0,0 +1,233 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+#include "container.hh"
+
+//=================================
+//
+//  ordered qualifiers
+//
+//=================================
+
+namespace cdi {
+
+
+namespace detail {
+
+	// Implementation of qualifiers with totally ordered values
+	template <typename Qual, typename Value>
+	struct ordered_impl : qual_state<Value>
+	{
+		typedef Qual qualifier_type;
+
+		ordered_impl(const Value& v)
+		: qual_state<Value>(u::type_id_of<qualifier_type>(), typeid(qualifier_type), v) {
+			this->set_matches_by_equality(true);
+		}
+	};
+
+	// Implementation of range patterns [lo, hi) over an ordered qualifier type
+	template <typename Qual, typename Value>
+	struct range_impl : qual_base
+	{
+		typedef range_impl<Qual, Value> range_type;
+
+		range_impl(const Value& _lo, const Value& _hi)
+		: qual_base(u::type_id_of<range_type>(), typeid(range_type), value_hash(_lo, _hi)),
+		  lo(_lo), hi(_hi)
+		{ }
+
+		inline const Value& lower() const { return lo; }
+		inline const Value& upper() const { return hi; }
+
+		inline bool contains(const Value& v) const { return !(v < lo) && (v < hi); }
+
+		bool equals(const qual_base& other) const override {
+			if(! qual_base::equals(other)) return false;
+			auto& o = static_cast<const range_type&>(other);
+			return !(lo < o.lo) && !(o.lo < lo) && !(hi < o.hi) && !(o.hi < hi);
+		}
+
+		bool matches(const qual_base& other) const override {
+			if(other.type_id()==this->type_id()) return equals(other);
+			if(other.type_id()!=u::type_id_of<Qual>()) return false;
+			return contains(static_cast<const qual_state<Value>&>(other).value());
+		}
+
+		// named after the qualifier type it ranges over
+		string name() const override {
+			string ret = u::demangle(typeid(Qual).name());
+			if(ret.size() > qual_suffix.size()
+				&& std::equal(ret.end()-qual_suffix.size(), ret.end(), qual_suffix.begin()))
+				ret.resize(ret.size()-qual_suffix.size());
+			return ret;
+		}
+
+		std::ostream& output(std::ostream& s) const override {
+			typename qual_state_traits<Value>::printer pr;
+			qual_base::output(s) << "[";
+			pr(s, lo); s << ","; pr(s, hi);
+			s << ")";
+			return s;
+		}
+
+	private:
+		static size_t value_hash(const Value& lo, const Value& hi) {
+			typename qual_state_traits<Value>::hasher h;
+			size_t seed = h(lo);
+			u::combine_hash(seed, h(hi));
+			return seed;
+		}
+
+		const Value lo, hi;
+	};
+
+}
+
+
+/**
+	The object representing an ordered qualifier type, defined by
+	DEFINE_ORDERED_QUALIFIER.
+
+	It makes qualifiers by calling it, and range patterns by `range()`:
+	```
+	DEFINE_ORDERED_QUALIFIER(Version, int, int)
+
+	resource<Codec*> v4({Version(4)});
+	qualifiers pattern {Version.range(3,5)};   // matches {Version(3)} and {Version(4)}
+	```
+  */
+template <typename Qual, typename Arg>
+struct ordered_kind
+{
+	typedef Qual qualifier_type;
+	typedef typename Qual::value_type value_type;
+	typedef detail::range_impl<Qual, value_type> range_type;
+
+	/// Return a qualifier with the given value
+	inline qualifier operator()(Arg val) const { return qualifier(new Qual(val)); }
+
+	/**
+		Return a qualifier matching the qualifiers of this type with
+		value in `[lo, hi)`.
+	  */
+	inline qualifier range(const value_type& lo, const value_type& hi) const {
+		return qualifier(new range_type(lo, hi));
+	}
+};
+
+
+/**
+	Macro to define a qualifier type whose values are totally ordered
+	(by `operator<`).
+
+	Resources qualified by such qualifiers can be looked up by value range,
+	see `select()`.
+  */
+#define DEFINE_ORDERED_QUALIFIER(qname, qvalue_type, arg_type) \
+struct QUAL_CLASS(qname) : cdi::detail::ordered_impl< QUAL_CLASS(qname), qvalue_type> { \
+	using cdi::detail::ordered_impl< QUAL_CLASS(qname), qvalue_type>::ordered_impl; \
+};\
+inline const cdi::ordered_kind< QUAL_CLASS(qname), arg_type> qname {};\
+
+
+/**
+	A sorted index of the declared resources of a resource type, by the
+	value of an ordered qualifier.
+
+	@tparam Resource the resource type
+	@tparam Qual the ordered qualifier class
+
+	The index is brought up to date at each lookup, by scanning the
+	declarations made since the previous one (see `container::declarations()`),
+	so the cost of maintaining it is O(log n) per declaration, and a range
+	lookup costs O(log n + k) for k results. Declared aliases are included.
+  */
+template <typename Resource, typename Qual>
+class ordered_index
+{
+public:
+	typedef typename Qual::value_type value_type;
+
+	/// The index of the container, for this resource type and qualifier type
+	static ordered_index& instance() {
+		static ordered_index idx;
+		return idx;
+	}
+
+	/**
+		Append the ids of the resources whose value is in `[lo, hi)` to `out`,
+		in ascending order of value.
+	  */
+	template <typename OutputIterator>
+	OutputIterator find(const value_type& lo, const value_type& hi, OutputIterator out)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		refresh();
+		if(hi < lo) return out;
+		for(auto it = entries.lower_bound(lo); it!=entries.end() && it->first < hi; ++it)
+			*out++ = it->second;
+		return out;
+	}
+
+private:
+	void refresh()
+	{
+		container& c = providence();
+		if(c.epoch()!=epoch) {
+			entries.clear();
+			scanned = 0;
+			epoch = c.epoch();
+		}
+
+		auto& log = c.declarations();
+		const u::type_id rtype = u::type_id_of<Resource>();
+		const u::type_id qtype = u::type_id_of<Qual>();
+		for(; scanned < log.size(); ++scanned) {
+			const resourceid& rid = log[scanned];
+			if(rid.type_id()!=rtype) continue;
+			for(auto& q : rid.quals())
+				if(q.type_id()==qtype)
+					entries.emplace(q.value<value_type>(), rid);
+		}
+	}
+
+	std::mutex mutex;
+	std::multimap<value_type, resourceid> entries;
+	size_t scanned = 0;
+	size_t epoch = 0;
+};
+
+
+/**
+	Return the declared resources of a type whose ordered qualifier has a
+	value in `[lo, hi)`.
+
+	@tparam Instance the instance type of the resources
+	@param kind the ordered qualifier type
+	@param lo the lower bound of the range (included)
+	@param hi the upper bound of the range (excluded)
+	@return the resources found, in ascending order of value
+	```
+	for(auto& codec : select<Codec*>(Version, 3, 5))
+		use(codec.get());
+	```
+  */
+template <typename Instance, typename Qual, typename Arg>
+std::vector< resource<Instance> > select(const ordered_kind<Qual, Arg>& kind,
+	const typename Qual::value_type& lo, const typename Qual::value_type& hi)
+{
+	std::vector<resourceid> ids;
+	ordered_index<resource<Instance>, Qual>::instance().find(lo, hi, std::back_inserter(ids));
+
+	std::vector< resource<Instance> > ret;
+	ret.reserve(ids.size());
+	for(auto& rid : ids) ret.emplace_back(rid.quals());
+	return ret;
+}
+
+
+} // end namespace cdi
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include "cdi.hh"
+#include "ordered.hh"
+
+using namespace cdi;
+using namespace std;
+
+DEFINE_ORDERED_QUALIFIER(Version, int, int)
+DEFINE_ORDERED_QUALIFIER(Tier, string, const string&)
+
+class OrderedSuite : public CxxTest::TestSuite
+{
+public:
+
+	void tearDown() {
+		providence().clear();
+	}
+
+	void test_range_pattern()
+	{
+		qualifier r = Version.range(3,5);
+		TS_ASSERT(r.matches(Version(3)));
+		TS_ASSERT(r.matches(Version(4)));
+		TS_ASSERT(! r.matches(Version(5)));
+		TS_ASSERT(! r.matches(Tier("3")));
+		TS_ASSERT_EQUALS(r, Version.range(3,5));
+		TS_ASSERT_DIFFERS(r, Version.range(3,6));
+		TS_ASSERT(Version(4).matches_by_equality());
+
+		qualifiers pattern {r, Default};
+		TS_ASSERT(pattern.matches({Version(4), Default}));
+		TS_ASSERT(! pattern.matches({Version(2), Default}));
+
+		ostringstream s;
+		s << r;
+		TS_ASSERT_EQUALS(s.str(), "@Version[3,5)");
+	}
+
+	void test_select()
+	{
+		for(int v=1; v<=6; ++v) {
+			resource<int> codec({Version(v)});
+			codec.provide([v]() { return 10*v; });
+		}
+		resource<long>({Version(4)}).provide([]() { return 0l; });
+		resource<int>({Tier("gold")}).provide([]() { return 0; });
+
+		auto found = select<int>(Version, 3, 5);
+		TS_ASSERT_EQUALS(found.size(), 2);
+		TS_ASSERT_EQUALS(found[0].get(), 30);
+		TS_ASSERT_EQUALS(found[1].get(), 40);
+
+		// the index catches up with new declarations
+		resource<int>({Version(3), Default}).provide([]() { return 31; });
+		TS_ASSERT_EQUALS(select<int>(Version, 3, 5).size(), 3);
+		TS_ASSERT_EQUALS(select<int>(Version, 7, 9).size(), 0);
+		TS_ASSERT_EQUALS(select<int>(Version, 5, 3).size(), 0);
+
+		// and is rebuilt after the container is cleared
+		providence().clear();
+		resource<int>({Version(4)}).provide([]() { return 4; });
+		found = select<int>(Version, 0, 10);
+		TS_ASSERT_EQUALS(found.size(), 1);
+		TS_ASSERT_EQUALS(found[0].get(), 4);
+
+		// the exports of pending modules are found
+		resource<int> lazy({Version(5)});
+		providence().add_module(vector<resourceid>{lazy},
+			[&]() { lazy.provide([]() { return 5; }); });
+		found = select<int>(Version, 0, 10);
+		TS_ASSERT_EQUALS(found.size(), 2);
+		TS_ASSERT_EQUALS(found[1].get(), 5);
+	}
+};
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+//=================================
+//
+//  work-stealing thread pool
+//
+//=================================
+
+namespace cdi {
+
+class work_stealing_pool;
+
+namespace detail {
+	// identifies the worker threads of pools
+	struct worker_id {
+		const work_stealing_pool* pool = nullptr;
+		size_t index = 0;
+	};
+}
+
+/**
+	A fixed-size thread pool with per-worker task queues.
+
+	Each worker owns a queue; tasks submitted by a worker go to its own
+	queue, tasks submitted from other threads are spread round-robin.
+	A worker takes tasks from the back of its own queue and, when that is
+	empty, steals from the front of the other queues.
+
+	Threads waiting for a `task_group` help by running pending tasks,
+	so that waiting from within a task cannot deadlock the pool.
+  */
+class work_stealing_pool
+{
+public:
+	typedef std::function<void()> task;
+
+	/**
+		Start the workers.
+		@param nthreads the number of worker threads (at least 1)
+	  */
+	explicit work_stealing_pool(size_t nthreads)
+		: queues(nthreads==0 ? 1 : nthreads)
+	{
+		for(size_t i=0; i < queues.size(); ++i)
+			workers.emplace_back([this, i]() { work(i); });
+	}
+
+	/** Stop the workers, after running all queued tasks */
+	~work_stealing_pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex);
+			stopping = true;
+		}
+		idle.notify_all();
+		for(auto& w : workers) w.join();
+	}
+
+	work_stealing_pool(const work_stealing_pool&) = delete;
+	work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+	/** Return the number of workers */
+	inline size_t size() const { return queues.size(); }
+
+	/** Queue a task for execution */
+	void submit(task t)
+	{
+		size_t i = (current.pool==this) ? current.index
+			: next.fetch_add(1, std::memory_order_relaxed) % queues.size();
+		{
+			std::lock_guard<std::mutex> lock(queues[i].mutex);
+			queues[i].tasks.push_back(std::move(t));
+		}
+		{
+			std::lock_guard<std::mutex> lock(idle_mutex);
+			++pending;
+		}
+		idle.notify_one();
+	}
+
+	/**
+		Run one queued task in the calling thread, if there is any.
+		@return true if a task was run
+	  */
+	bool run_one()
+	{
+		size_t home = (current.pool==this) ? current.index : 0;
+		task t;
+		if(! take(home, t)) return false;
+		t();
+		return true;
+	}
+
+private:
+	struct worker_queue {
+		std::mutex mutex;
+		std::deque<task> tasks;
+	};
+
+	// the pool and worker index of the calling thread, if it is a worker
+	static inline thread_local detail::worker_id current;
+
+	bool take(size_t home, task& t)
+	{
+		for(size_t k=0; k < queues.size(); ++k) {
+			size_t i = (home + k) % queues.size();
+			std::lock_guard<std::mutex> lock(queues[i].mutex);
+			auto& q = queues[i].tasks;
+			if(q.empty()) continue;
+			if(k==0) {  // own queue: LIFO
+				t = std::move(q.back());
+				q.pop_back();
+			} else {    // steal: FIFO
+				t = std::move(q.front());
+				q.pop_front();
+			}
+			std::lock_guard<std::mutex> ilock(idle_mutex);
+			--pending;
+			return true;
+		}
+		return false;
+	}
+
+	void work(size_t i)
+	{
+		current = { this, i };
+		while(true) {
+			task t;
+			if(take(i, t)) {
+				t();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(idle_mutex);
+			idle.wait(lock, [this]() { return pending>0 || stopping; });
+			if(pending==0 && stopping) return;
+		}
+	}
+
+	std::vector<worker_queue> queues;
+	std::vector<std::thread> workers;
+	std::atomic<size_t> next {0};
+
+	std::mutex idle_mutex;
+	std::condition_variable idle;
+	size_t pending = 0;   // guarded by idle_mutex
+	bool stopping = false;
+};
+
+
+/**
+	A set of tasks run on a pool, which can be waited for as a whole.
+
+	Tasks should not throw; exceptions escaping a task are swallowed.
+	```
+	task_group g(pool);
+	for(auto& x : items) g.run([&x]() { process(x); });
+	g.wait();
+	```
+  */
+class task_group
+{
+public:
+	explicit task_group(work_stealing_pool& p) : pool(p) { }
+
+	/** Wait for outstanding tasks */
+	~task_group() { wait(); }
+
+	task_group(const task_group&) = delete;
+	task_group& operator=(const task_group&) = delete;
+
+	/** Submit a task to the pool */
+	template <typename F>
+	void run(F&& f)
+	{
+		{
+			std::lock_guard<std::mutex> lock(state->mutex);
+			++state->outstanding;
+		}
+		pool.submit([s=state, f=std::forward<F>(f)]() mutable {
+			try { f(); } catch(...) { }
+			std::lock_guard<std::mutex> lock(s->mutex);
+			if(--s->outstanding==0) s->done.notify_all();
+		});
+	}
+
+	/**
+		Wait for all submitted tasks to complete, helping to run
+		queued tasks in the meantime.
+	  */
+	void wait()
+	{
+		while(true) {
+			{
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if(state->outstanding==0) return;
+			}
+			if(pool.run_one()) continue;
+
+			// nothing left to help with; our tasks are running elsewhere
+			std::unique_lock<std::mutex> lock(state->mutex);
+			state->done.wait(lock, [this]() { return state->outstanding==0; });
+			return;
+		}
+	}
+
+private:
+	struct shared_state {
+		std::mutex mutex;
+		std::condition_variable done;
+		size_t outstanding = 0;
+	};
+
+	work_stealing_pool& pool;
+	std::shared_ptr<shared_state> state = std::make_shared<shared_state>();
+};
+
+
+} // end namespace cdi
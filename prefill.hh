@@ -0,0 +1,314 @@
+#pragma once
+
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include "scope.hh"
+
+//=================================
+//
+//  pre-provisioning of transient instances
+//
+//=================================
+
+namespace cdi {
+
+
+namespace detail {
+
+	/**
+		A queue refilled by the prefill worker.
+	  */
+	struct refillable : ready_source
+	{
+		/// Return true if the queue is below its low-water mark
+		virtual bool needs_refill() const = 0;
+
+		/// Make instances until the queue reaches its low-water mark
+		virtual void refill() = 0;
+	};
+
+	/**
+		The background thread refilling the ready queues.
+
+		There is one thread for all queues, started when the first queue
+		is made.
+	  */
+	class prefill_worker
+	{
+	public:
+		static prefill_worker& instance() {
+			static prefill_worker w;
+			return w;
+		}
+
+		/// Add a queue to refill
+		void add(std::weak_ptr<refillable> q)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				queues.push_back(std::move(q));
+				pending = true;
+				if(! worker.joinable())
+					worker = std::thread([this]() { work(); });
+			}
+			wakeup.notify_one();
+		}
+
+		/// Signal that some queue may need refilling
+		void wake()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				pending = true;
+			}
+			wakeup.notify_one();
+		}
+
+		~prefill_worker()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wakeup.notify_one();
+			if(worker.joinable()) worker.join();
+		}
+
+	private:
+		prefill_worker() = default;
+
+		void work()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while(true) {
+				wakeup.wait(lock, [this]() { return pending || stopping; });
+				if(stopping) return;
+				pending = false;
+
+				// forget the queues that are gone, and refill the others
+				std::vector<std::shared_ptr<refillable>> due;
+				for(auto iter = queues.begin(); iter!=queues.end(); ) {
+					if(auto q = iter->lock()) {
+						if(q->needs_refill()) due.push_back(std::move(q));
+						++iter;
+					} else
+						iter = queues.erase(iter);
+				}
+				lock.unlock();
+				for(auto& q : due) q->refill();
+				due.clear();
+				lock.lock();
+			}
+		}
+
+		std::mutex mutex;
+		std::condition_variable wakeup;
+		std::vector<std::weak_ptr<refillable>> queues;  // guarded by mutex
+		bool pending = false;                           // guarded by mutex
+		bool stopping = false;                          // guarded by mutex
+		std::thread worker;
+	};
+}
+
+
+/**
+	A queue of ready instances of a resource in `New` scope.
+
+	@tparam Instance the instance type of the resource
+
+	A background thread keeps the queue filled to its low-water mark, by
+	running the lifecycle calls of the resource, with its dependencies
+	resolved once (as in a `factory`). A `get()` of the resource pops a
+	created instance from the queue in O(1), and only makes one inline when
+	the queue is empty (a miss).
+
+	Instances are made on another thread, so the lifecycle calls of the
+	resource must be safe to run concurrently with the rest of the program,
+	and lifecycle events of queued instances are not reported to observers.
+	@see prefill()
+  */
+template <typename Instance>
+class ready_queue : public detail::refillable
+{
+public:
+	/// The instance type of the resource
+	typedef Instance instance_type;
+
+	/**
+		Construct a queue.
+		@param lc the lifecycle of the resource
+		@param low_water the number of instances to keep ready
+	  */
+	ready_queue(std::shared_ptr<const prebound_lifecycle<Instance>> lc, size_t low_water)
+	: lifecycle(std::move(lc)), low(low_water) { }
+
+	/// Return the number of ready instances
+	size_t depth() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return ready.size();
+	}
+
+	/// Return the number of instances taken from the queue
+	size_t hits() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return n_hits;
+	}
+
+	/// Return the number of gets which found the queue empty
+	size_t misses() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return n_misses;
+	}
+
+	/// Return the number of background instantiations which failed
+	size_t failures() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return n_failures;
+	}
+
+	/// Return the low-water mark
+	inline size_t low_water() const { return low; }
+
+	bool pop(asset& ass) override
+	{
+		bool found, wake;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(closed) return false;
+			found = ! ready.empty();
+			if(found) {
+				// New scope does not dispose the instance, nor its dependencies
+				lifecycle->release(ready.front());
+				ass.object() = std::move(ready.front());
+				ready.pop_front();
+				++ n_hits;
+			} else
+				++ n_misses;
+			stalled = false;
+			wake = ready.size() < low;
+		}
+		if(wake) detail::prefill_worker::instance().wake();
+		return found;
+	}
+
+	void close() override
+	{
+		std::deque<Instance> left;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			closed = true;
+			idle.wait(lock, [this]() { return ! building; });
+			left.swap(ready);
+		}
+		for(auto& obj : left)
+			lifecycle->dispose(obj);
+	}
+
+	bool needs_refill() const override {
+		std::lock_guard<std::mutex> lock(mutex);
+		return ! closed && ! stalled && ready.size() < low;
+	}
+
+	void refill() override
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		while(! closed && ! stalled && ready.size() < low) {
+			building = true;
+			lock.unlock();
+			std::optional<Instance> obj;
+			try {
+				obj.emplace(lifecycle->create());
+			} catch(...) { }
+			lock.lock();
+			if(obj && closed) {
+				lock.unlock();
+				lifecycle->dispose(*obj);
+				obj.reset();
+				lock.lock();
+			}
+			building = false;
+			if(obj)
+				ready.push_back(std::move(*obj));
+			else if(! closed) {
+				// retry when an instance is taken
+				++ n_failures;
+				stalled = true;
+			}
+		}
+		idle.notify_all();
+	}
+
+private:
+	std::shared_ptr<const prebound_lifecycle<Instance>> lifecycle;
+	const size_t low;
+
+	mutable std::mutex mutex;
+	std::condition_variable idle;
+	std::deque<Instance> ready;   // guarded by mutex
+	size_t n_hits = 0;            // guarded by mutex
+	size_t n_misses = 0;          // guarded by mutex
+	size_t n_failures = 0;        // guarded by mutex
+	bool building = false;        // guarded by mutex
+	bool stalled = false;         // guarded by mutex
+	bool closed = false;          // guarded by mutex
+};
+
+
+/**
+	Keep ready instances of a resource in `New` scope.
+
+	@tparam Instance the instance type of the resource
+	@param r a resource in `New` scope
+	@param low_water the number of instances to keep ready
+	@return the queue of ready instances, for monitoring
+	@throws instantiation_error if the resource is not declared, not in
+	        `New` scope, or its dependencies cannot be resolved
+
+	The dependencies of `r` are resolved by this call, except those in `New`
+	scope, which each queued instance gets anew. The queue replaces
+	any previous queue of the resource, and is closed (disposing the
+	instances not taken) by `container::clear()`, or by calling
+	`prefill(r, 0)`.
+	```
+	resource<Parser*> parser({New});
+	parser.provide(make_parser, grammar);
+	auto q = prefill(parser, 16);
+	...
+	Parser* p = parser.get();     // usually popped from q
+	```
+  */
+template <typename Instance>
+std::shared_ptr<ready_queue<Instance>> prefill(const resource<Instance>& r, size_t low_water)
+{
+	resource_manager<resource<Instance>>* rm = providence().get_declared(r);
+	if(rm==nullptr)
+		throw instantiation_error(u::str_builder()
+			<< "Undeclared resource in prefilling " << resourceid(r));
+	if(rm->scope_qual().type_id()!=u::type_id_of<NewScope>())
+		throw instantiation_error(u::str_builder()
+			<< "Prefilling " << resourceid(r) << ", which is not in New scope");
+	if(low_water==0) {
+		NewScope::set_ready_source(rm->rid(), nullptr);
+		return nullptr;
+	}
+
+	std::shared_ptr<ready_queue<Instance>> q;
+	try {
+		q = std::make_shared<ready_queue<Instance>>(rm->prebind(), low_water);
+	} catch(...) {
+		std::throw_with_nested(instantiation_error(u::str_builder()
+			<< "Error while prefilling " << rm->rid()));
+	}
+	NewScope::set_ready_source(rm->rid(), q);
+	detail::prefill_worker::instance().add(q);
+	return q;
+}
+
+
+} // end namespace cdi
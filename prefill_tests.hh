@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include <thread>
+
+#include "cdi.hh"
+#include "prefill.hh"
+
+using namespace cdi;
+using namespace std;
+
+class PrefillSuite : public CxxTest::TestSuite
+{
+public:
+
+	void tearDown() {
+		providence().clear();
+	}
+
+	// wait for the background worker
+	template <typename Pred>
+	static bool eventually(Pred pred) {
+		for(int i=0; i<1000 && ! pred(); ++i)
+			this_thread::sleep_for(chrono::milliseconds(1));
+		return pred();
+	}
+
+	void test_prefill()
+	{
+		atomic<int> made {0}, disposed {0};
+		resource<int> base({});
+		base.provide([]() { return 1000; });
+		resource<int> r({New});
+		r.provide([&](int b) { return b + ++made; }, base)
+		 .dispose([&](int&) { ++disposed; });
+
+		auto q = prefill(r, 4);
+		TS_ASSERT_EQUALS(q->low_water(), 4);
+		TS_ASSERT(eventually([&]() { return q->depth()==4; }));
+
+		// popped in order of construction
+		TS_ASSERT_EQUALS(r.get(), 1001);
+		TS_ASSERT_EQUALS(r.get(), 1002);
+		TS_ASSERT_EQUALS(q->hits(), 2);
+		TS_ASSERT(eventually([&]() { return q->depth()==4; }));
+		TS_ASSERT_EQUALS(made, 6);
+
+		// closing disposes the instances not taken
+		prefill(r, 0);
+		TS_ASSERT_EQUALS(disposed, 4);
+		int inline_made = r.get();
+		TS_ASSERT_EQUALS(inline_made, 1007);
+		TS_ASSERT_EQUALS(q->hits(), 2);
+	}
+
+	void test_misses()
+	{
+		atomic<bool> slow {true};
+		atomic<int> made {0};
+		resource<int> r({New});
+		r.provide([&]() {
+			while(slow && this_thread::get_id()!=main_thread)
+				this_thread::sleep_for(chrono::milliseconds(1));
+			return ++made;
+		});
+
+		main_thread = this_thread::get_id();
+		auto q = prefill(r, 2);
+		TS_ASSERT_EQUALS(q->depth(), 0);
+		r.get();    // made inline
+		TS_ASSERT_EQUALS(q->misses(), 1);
+		slow = false;
+		TS_ASSERT(eventually([&]() { return q->depth()==2; }));
+		r.get();
+		TS_ASSERT_EQUALS(q->misses(), 1);
+		TS_ASSERT_EQUALS(q->hits(), 1);
+	}
+
+	void test_errors()
+	{
+		resource<int> g({});
+		TS_ASSERT_THROWS(prefill(g, 1), instantiation_error);
+		resource<int> u({New, Default});
+		TS_ASSERT_THROWS(prefill(u, 1), instantiation_error);
+
+		resource<int> r({New});
+		atomic<bool> fail {true};
+		r.provide([&]() -> int { if(fail) throw runtime_error("no"); return 1; });
+		auto q = prefill(r, 1);
+		TS_ASSERT(eventually([&]() { return q->failures()==1; }));
+		fail = false;
+		TS_ASSERT_EQUALS(r.get(), 1);    // inline, and retried in the background
+		TS_ASSERT(eventually([&]() { return q->depth()==1; }));
+	}
+
+	void test_transient_dependency()
+	{
+		// each queued instance gets its own New-scope dependency
+		atomic<int> made {0}, disposed {0};
+		resource<int*> cell({New});
+		cell.provide([&]() { return new int(++made); })
+		    .dispose([&](int* p) { ++disposed; delete p; });
+		resource<int**> holder({New});
+		holder.provide([](int* c) { return new int*(c); }, cell)
+		      .dispose([](int** h) { delete h; });
+
+		auto q = prefill(holder, 3);
+		TS_ASSERT(eventually([&]() { return q->depth()==3; }));
+		int** a = holder.get();
+		int** b = holder.get();
+		TS_ASSERT_DIFFERS(*a, *b);
+		TS_ASSERT_EQUALS(**a, 1);
+		TS_ASSERT_EQUALS(**b, 2);
+
+		// the dependencies of the instances not taken are disposed with them
+		TS_ASSERT(eventually([&]() { return q->depth()==3; }));
+		prefill(holder, 0);
+		TS_ASSERT_EQUALS(disposed, made-2);
+		for(int** h : {a, b}) {
+			delete *h;
+			delete h;
+		}
+	}
+
+	static inline thread::id main_thread;
+};
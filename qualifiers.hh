@@ -6,6 +6,14 @@
 #include <string>
 #include <algorithm>
 #include <iterator>
+#include <vector>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #include "exceptions.hh"
 
@@ -74,12 +82,12 @@ struct qual_base
 	/**
 		Initialize the object.
 
-		@param ti  the type index of the qualifier instance.
+		@param ti  the type of the qualifier instance.
 		@param vhash a hash value for the additional state of the object
 
 		The implementation caches the hash value for the object, therefore
 		this value must be provided to the constructor. This value is
-		combined with the hash value of type(), to produce the final
+		combined with the hash value of the type id, to produce the final
 		hash code for the object.
 
 		If qualifier type (i.e., a subclass) does not wish to provide
@@ -88,8 +96,25 @@ struct qual_base
 		subclass constructor) by calling method  set_value_hash().
 
 	  */
-	inline qual_base(const std::type_index& ti, size_t vhash)
-	: _type(ti), hcode(compute_hash(ti, vhash)) { }
+	inline qual_base(const std::type_info& ti, size_t vhash)
+	: qual_base(u::type_id_for(ti), ti, vhash) { }
+
+	/**
+		Initialize the object, given the type id of the qualifier type.
+
+		@param id  the type id of the qualifier type, as returned by
+		           `utilities::type_id_of()`
+		@param ti  the type of the qualifier type
+		@param vhash a hash value for the additional state of the object
+		@param eq  true if `matches()` coincides with `equals()`
+
+		This avoids the registry lookup of the other constructor. When `id`
+		is a static type id, this is a constant expression, so that
+		qualifier objects with static storage can be constant-initialized
+		(see `detail::qual_literal`).
+	  */
+	constexpr qual_base(u::type_id id, const std::type_info& ti, size_t vhash, bool eq = false)
+	: _type(&ti), tid(id), hcode(compute_hash(id, vhash)), by_equality(eq) { }
 
 	/// Destructor
 	virtual ~qual_base() { }
@@ -119,7 +144,25 @@ struct qual_base
 	/**
 		Return the type index of the qualifier type.
 	  */
-	inline const std::type_index& type() const { return _type; }
+	inline std::type_index type() const { return *_type; }
+
+	/**
+		Return the type id of the qualifier type.
+
+		Type ids identify qualifier types in comparisons and hashing;
+		`type()` is kept for diagnostics.
+	  */
+	inline u::type_id type_id() const { return tid; }
+
+	/**
+		Return true if this object has the same qualifier type as another.
+
+		Static type ids (see `utilities::static_type_id()`) may collide, so
+		for them the types are also compared.
+	  */
+	inline bool same_type(const qual_base& other) const {
+		return tid==other.tid && (tid < u::static_type_ids || *_type==*other._type);
+	}
 
 	/**
 		Return a hash code for this object.
@@ -135,7 +178,7 @@ struct qual_base
 		order to check equality of the additional state.
 	  */
 	virtual inline bool equals(const qual_base& other) const {
-		return (hcode==other.hcode) && (type()==other.type());
+		return (hcode==other.hcode) && same_type(other);
 	}
 
 	/**
@@ -145,6 +188,17 @@ struct qual_base
 		return equals(other);
 	}
 
+	/**
+		Return true if `matches()` is known to coincide with `equals()`.
+
+		When this is true, `qualifiers` can skip calls to `matches()` for
+		elements with different hash codes. Qualifier classes defined via
+		`detail::qual_impl` set this automatically, unless they declare their own
+		`matches()`. For other subclasses it is false, unless set by calling
+		`set_matches_by_equality()`.
+	  */
+	inline bool matches_by_equality() const { return by_equality; }
+
 	/**
 		Output the qualifier to a stream.
 
@@ -172,25 +226,36 @@ protected:
 		changes, this method can be used to recompute and cache the new hash value.
 	*/
 	void set_value_hash(size_t vhash) {
-		hcode = compute_hash(_type, vhash);
+		hcode = compute_hash(tid, vhash);
+	}
+
+	/**
+		Declare that `matches()` coincides with `equals()` for this object.
+
+		A subclass that does not override `matches()` can call this to
+		speed up qualifier set matching.
+	  */
+	void set_matches_by_equality(bool flag = true) {
+		by_equality = flag;
 	}
 
 	/**
-		Compute the hash_code for an object with the given type index and value hash.
-		@param ti the type index of the qualifier class
+		Compute the hash_code for an object with the given type id and value hash.
+		@param id the type id of the qualifier class
 		@param vhash a hash value for the additional state
 	  */
-	inline static size_t compute_hash(const std::type_index& ti, size_t vhash)
+	constexpr static size_t compute_hash(u::type_id id, size_t vhash)
 	{
-		size_t seed = 0;
-		u::hash_combine(seed, ti.hash_code());
-		u::hash_combine(seed, vhash);
+		size_t seed = u::mix_hash(id);
+		u::combine_hash(seed, vhash);
 		return seed;
 	}
 
 private:
-	std::type_index _type;
+	const std::type_info* _type;
+	u::type_id tid;
 	size_t hcode;
+	bool by_equality;
 };
 
 
@@ -198,6 +263,15 @@ namespace detail {
 
 	using std::ostream;
 
+	// Detect whether a qualifier class declares its own `matches()`
+	template <typename Qual, class = std::void_t<> >
+	struct declares_matches : std::false_type { };
+
+	template <typename Qual>
+	struct declares_matches<Qual, std::void_t<decltype(&Qual::matches)> >
+	: std::bool_constant< ! std::is_same_v<decltype(&Qual::matches),
+			bool (qual_base::*)(const qual_base&) const> > { };
+
 	template<typename Value>
 	struct ostream_printer {
 		inline ostream& operator()(ostream& s, const Value& val) const {
@@ -222,9 +296,12 @@ namespace detail {
 		typedef typename qual_state_traits<Value>::equal_to equal_to;
 		typedef typename qual_state_traits<Value>::printer printer;
 
-		qual_state(const std::type_index& ti, const value_type& v)
+		qual_state(const std::type_info& ti, const value_type& v)
 		: qual_base(ti, hasher()(v)), val(v) { }
 
+		qual_state(u::type_id id, const std::type_info& ti, const value_type& v)
+		: qual_base(id, ti, hasher()(v)), val(v) { }
+
 		const value_type& value() const { return val; }
 
 		bool equals(const qual_base& other) const override {
@@ -250,7 +327,9 @@ namespace detail {
 		typedef Qual qualifier_type;
 
 		qual_impl(const Value& v)
-		: qual_state<Value>(typeid(qualifier_type), v) { }
+		: qual_state<Value>(u::type_id_of<qualifier_type>(), typeid(qualifier_type), v) {
+			this->set_matches_by_equality(! declares_matches<Qual>::value);
+		}
 	};
 
 	template <typename Qual>
@@ -261,16 +340,44 @@ namespace detail {
 		typedef void hasher;
 		typedef void printer;
 
-		qual_impl() : qual_base(typeid(qualifier_type), (size_t)0) { }
+		// qualifiers without state have static type ids
+		typedef void static_id_tag;
+
+		constexpr qual_impl()
+		: qual_base(u::type_id_of<qualifier_type>(), typeid(qualifier_type), (size_t)0,
+			! declares_matches<Qual>::value)
+		{ }
 	};
 
+	/**
+		A constant-initialized instance of a qualifier class.
+
+		This is defined for qualifier classes with a constexpr default
+		constructor, i.e., classes without state whose type id is static.
+		No code runs to create it: the type id, hash code and the object
+		itself are computed at compile time.
+		@see qualifier::qualifier(const Qual&)
+	  */
+	template <typename Qual>
+	inline const Qual qual_literal {};
+
 } // end namespace detail
 
 
 class qualifier;
+class match_memo;
 /// Standard qualifiers
 extern qualifier Default, All, Null;
 
+namespace detail {
+	/**
+		Set by `container::prefork()`: comparisons of qualifiers and resource
+		ids no longer merge the states of equal objects, so that they do not
+		write to memory.
+	  */
+	inline bool preforked = false;
+}
+
 
 /**
 	A tagging object used to annotate resources.
@@ -281,7 +388,9 @@ extern qualifier Default, All, Null;
 	Qualifiers can also take a value as attribute.
 
 	Instances of class qualifier are std::shared_ptr wrappers, that point to an underlying
-	implementation object.
+	implementation object. Qualifiers without state (e.g., those defined by
+	`DEFINE_VOID_QUALIFIER`) point to a qualifier literal instead, which is
+	constant-initialized and not reference-counted.
 
 	There are some standard qualifiers: `Default` and 'All'.
 
@@ -327,7 +436,7 @@ public:
 
 	/// Constructor. This should not be used in user code.
 	inline qualifier(qual_base* p=nullptr)
-	: sptr(p)
+	: ptr(p), sptr(p)
 	{
 		if(p==nullptr)
 			(*this) = Null;
@@ -335,28 +444,48 @@ public:
 
 	template <typename QualBase>
 	inline qualifier(const std::shared_ptr<QualBase>& p)
-	: sptr(p)
+	: ptr(p.get()), sptr(p)
 	{
 		if(sptr==nullptr)
 			(*this) = Null;
 	}
 
 	inline qualifier(std::shared_ptr<qual_base>&& p)
-	: sptr(p)
+	: ptr(p.get()), sptr(p)
 	{
 		if(sptr==nullptr)
 			(*this) = Null;
 	}
 
+	/**
+		Construct a qualifier referring to a qualifier literal.
+
+		@param literal an object with static storage duration, normally
+		       `detail::qual_literal<Qual>`
+
+		This is a constant expression: a qualifier variable initialized this
+		way is constant-initialized. The literal is not owned, so copying
+		the qualifier does not touch a reference count.
+	  */
+	template <typename Qual,
+		typename = std::enable_if_t< u::has_static_id<typename Qual::qualifier_type>::value > >
+	constexpr qualifier(const Qual& literal)
+	: ptr(&literal), sptr()
+	{ }
+
 	/// Compare two qualifiers for equality
 	inline bool operator==(const qualifier& other) const {
-		if(sptr == other.sptr)
+		if(ptr == other.ptr)
 			return true;
-		else if(sptr->equals(*other.sptr)) {
-			// combine into one state, speeding future compares
+		else if(ptr->equals(*other.ptr)) {
+			// combine into one state, speeding future compares,
+			// unless pages must stay clean
+			if(detail::preforked) return true;
 			if(sptr.use_count() > other.sptr.use_count()) {
+				ptr = other.ptr;
 				sptr = other.sptr;
 			} else {
+				other.ptr = ptr;
 				other.sptr = sptr;
 			}
 			return true;
@@ -369,17 +498,26 @@ public:
 	}
 
 	inline bool matches(const qualifier& other) const {
-		return sptr->matches( * other.sptr );
+		return ptr->matches( * other.ptr );
 	}
 
 	/// Qualifier name.
-	string name() const { return sptr->name(); }
+	string name() const { return ptr->name(); }
 
 	/// Type index of the qualifier type
-	std::type_index type() const { return sptr->type(); }
+	std::type_index type() const { return ptr->type(); }
+
+	/// Type id of the qualifier type
+	u::type_id type_id() const { return ptr->type_id(); }
+
+	/// True if the qualifier types of two qualifiers are the same
+	bool same_type(const qualifier& other) const { return ptr->same_type(*other.ptr); }
 
 	/// A hash code for this qualifier
-	size_t hash_code() const { return sptr->hash_code(); }
+	size_t hash_code() const { return ptr->hash_code(); }
+
+	/// True if matching this qualifier is the same as equality
+	bool matches_by_equality() const { return ptr->matches_by_equality(); }
 
 	/**
 		Retrieve the value of this qualifier (if any)
@@ -396,9 +534,9 @@ public:
 	  */
 	template <typename Value>
 	const Value& value() const {
-		const detail::qual_state<Value>* ptr = dynamic_cast<const detail::qual_state<Value>*>(sptr.get());
-		if(ptr)
-			return ptr->value();
+		auto vptr = dynamic_cast<const detail::qual_state<Value>*>(ptr);
+		if(vptr)
+			return vptr->value();
 		else
 			throw std::bad_cast();
 	}
@@ -417,19 +555,30 @@ public:
 	  */
 	template <typename QualType>
 	std::shared_ptr<const QualType> get() const {
-		return std::dynamic_pointer_cast<const QualType>(sptr);
+		auto qptr = dynamic_cast<const QualType*>(ptr);
+		if(qptr==nullptr) return nullptr;
+		return std::shared_ptr<const QualType>(sptr, qptr);
 	}
 
+	/**
+		Make this qualifier refcount-free; copying it will not write to memory.
+
+		@see utilities::make_immortal()
+	  */
+	void immortalize() const { sptr = u::make_immortal(sptr); }
+
 private:
-	mutable std::shared_ptr<const qual_base> sptr;
+	mutable const qual_base* ptr;
+	mutable std::shared_ptr<const qual_base> sptr;   // null for literals
 	friend std::ostream& operator<<(std::ostream& , const qualifier& q);
+	friend class match_memo;
 };
 
 
 /// Output the qualifier
 inline std::ostream& operator<<(std::ostream& s, const qualifier& q)
 {
-	return q.sptr->output(s);
+	return q.ptr->output(s);
 }
 
 
@@ -438,11 +587,14 @@ struct QUAL_CLASS(qname) : cdi::detail::qual_impl< QUAL_CLASS(qname) > { \
 	using cdi::detail::qual_impl< QUAL_CLASS(qname) >::qual_impl; \
 	body \
 };\
-inline cdi::qualifier qname { new QUAL_CLASS(qname)() };\
+inline cdi::qualifier qname { cdi::detail::qual_literal< QUAL_CLASS(qname) > };\
 
 
 /**
 	Macro to easily define a qualifier type with no additional state.
+
+	The qualifier is a literal: it is constant-initialized, so it can be
+	used during static initialization, in any order.
   */
 #define DEFINE_VOID_QUALIFIER(qname) DEFINE_VOID_QUALIFIER_CUSTOM(qname, )
 
@@ -468,6 +620,85 @@ DEFINE_VOID_QUALIFIER(Null);
 
 
 
+namespace detail {
+
+	/*
+		Vectorized scans over packed arrays of hash codes.
+
+		These are used by `qualifiers` to reject candidates by hash code,
+		before looking at the qualifier objects. With AVX2 four codes are
+		compared per instruction, with SSE2 two; otherwise a scalar loop is used.
+	  */
+
+#if defined(__AVX2__) && __SIZEOF_SIZE_T__==8
+	#define CDI_SIMD_HASH_AVX2
+#elif defined(__SSE2__) && __SIZEOF_SIZE_T__==8
+	#define CDI_SIMD_HASH_SSE2
+#endif
+
+#ifdef CDI_SIMD_HASH_SSE2
+	// 64-bit lane equality, using 32-bit compares (SSE2 lacks pcmpeqq)
+	inline __m128i cmpeq_epi64_sse2(__m128i a, __m128i b)
+	{
+		__m128i c = _mm_cmpeq_epi32(a, b);
+		return _mm_and_si128(c, _mm_shuffle_epi32(c, _MM_SHUFFLE(2,3,0,1)));
+	}
+#endif
+
+	/**
+		Return the first position `i` in `[from, n)` with `h[i]==key`, or `n`.
+	  */
+	inline size_t find_hash(const size_t* h, size_t n, size_t key, size_t from = 0)
+	{
+		size_t i = from;
+#if defined(CDI_SIMD_HASH_AVX2)
+		const __m256i k = _mm256_set1_epi64x((long long) key);
+		for(; i+4 <= n; i += 4) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(h+i));
+			int m = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, k)));
+			if(m) return i + __builtin_ctz(m);
+		}
+#elif defined(CDI_SIMD_HASH_SSE2)
+		const __m128i k = _mm_set1_epi64x((long long) key);
+		for(; i+2 <= n; i += 2) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h+i));
+			int m = _mm_movemask_pd(_mm_castsi128_pd(cmpeq_epi64_sse2(v, k)));
+			if(m) return i + ((m & 1) ? 0 : 1);
+		}
+#endif
+		for(; i < n; ++i)
+			if(h[i]==key) return i;
+		return n;
+	}
+
+	/**
+		Return true if arrays `a` and `b` of length `n` are equal.
+	  */
+	inline bool equal_hashes(const size_t* a, const size_t* b, size_t n)
+	{
+		size_t i = 0;
+#if defined(CDI_SIMD_HASH_AVX2)
+		for(; i+4 <= n; i += 4) {
+			__m256i x = _mm256_xor_si256(
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a+i)),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b+i)));
+			if(! _mm256_testz_si256(x, x)) return false;
+		}
+#elif defined(CDI_SIMD_HASH_SSE2)
+		for(; i+2 <= n; i += 2) {
+			__m128i c = cmpeq_epi64_sse2(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(a+i)),
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(b+i)));
+			if(_mm_movemask_epi8(c) != 0xFFFF) return false;
+		}
+#endif
+		for(; i < n; ++i)
+			if(a[i]!=b[i]) return false;
+		return true;
+	}
+
+} // end namespace detail
+
 
 /**
 	A set of qualifiers with a unique instance for each qualifier type.
@@ -498,6 +729,8 @@ public:
 
 	qualifiers(const qualifiers&) = default;
 	qualifiers(qualifiers&&) = default;
+	qualifiers& operator=(const qualifiers&) = default;
+	qualifiers& operator=(qualifiers&&) = default;
 
 	/**
 		Check membership in the set of a qualifier with the same type.
@@ -509,7 +742,12 @@ public:
 		This membership test ignores the value of the qualifier.
  	  */
 	inline bool contains_similar(const qualifier& q) const {
-		return qset.count(q)!=0;
+		const size_t n = size();
+		const size_t th = q.type_id();
+		for(size_t i = detail::find_hash(ptype.data(), n, th); i < n;
+				i = detail::find_hash(ptype.data(), n, th, i+1))
+			if(pelem[i].same_type(q)) return true;
+		return false;
 	}
 
 	/**
@@ -561,32 +799,75 @@ public:
 
 		Since mathcing between qualifiers is an arbitrary relation,
 		this relation is also arbitrary.
+
+		For elements whose matching is equality (see
+		`qual_base::matches_by_equality()`), candidates are first selected by
+		a vectorized scan over the hash codes of the other set; `matches()` is
+		only called on candidates with equal hash codes. Elements with custom
+		matching are tested against every element. When no element of this set
+		has custom matching, matching is the same as set equality.
+
+		When `match_memo` is enabled, the results for sets with custom matching
+		are memoized.
 	  */
-	bool matches(const qualifiers& other) const
+	bool matches(const qualifiers& other) const;
+
+private:
+	friend class match_memo;
+
+	// The matching algorithm, for sets with custom matching
+	bool match_elements(const qualifiers& other) const
 	{
+		const size_t n = size(), m = other.size();
+		const size_t* oh = other.phash.data();
+
 		// check that everything in this matches something in other
-		for(auto& a : qset) {
+		for(size_t i=0; i<n; ++i) {
 			bool matched=false;
-			for(auto& b : other.qset)
-				if(a.matches(b)) { matched=true; break; }
+			if(pexact[i]) {
+				for(size_t j = detail::find_hash(oh, m, phash[i]); j < m;
+						j = detail::find_hash(oh, m, phash[i], j+1))
+					if(pelem[i]==other.pelem[j]) { matched=true; break; }
+			} else {
+				for(size_t j=0; j<m; ++j)
+					if(pelem[i].matches(other.pelem[j])) { matched=true; break; }
+			}
 			if(! matched) return false;
 		}
-		for(auto& b : other.qset) {
+
+		// check that everything in other is matched by something in this
+		for(size_t j=0; j<m; ++j) {
 			bool matched=false;
-			for(auto& a: qset)
-				if(a.matches(b)) { matched=true; break; }
+			for(size_t i = detail::find_hash(phash.data(), n, oh[j]); i < n;
+					i = detail::find_hash(phash.data(), n, oh[j], i+1))
+				if(pexact[i] && pelem[i]==other.pelem[j]) { matched=true; break; }
+			for(size_t i=0; i<n && !matched && ncustom>0; ++i)
+				if(!pexact[i] && pelem[i].matches(other.pelem[j])) matched=true;
 			if(! matched) return false;
 		}
 		return true;
 	}
 
+public:
 
+	/**
+		Checks set equality.
 
-	/// Checks set equality
+		The sorted arrays of element hash codes are compared first (vectorized);
+		element equality is only checked when all hash codes coincide.
+	  */
 	inline bool operator==(const qualifiers& other) const
 	{
-		if(size()!=other.size())
+		const size_t n = size();
+		if(n!=other.size() || hcode!=other.hcode)
 			return false;
+		if(! detail::equal_hashes(phash.data(), other.phash.data(), n))
+			return false;
+		// elements are sorted by hash, so equal sets are (almost always)
+		// aligned; fall back to lookups if there are hash ties.
+		size_t i=0;
+		while(i<n && pelem[i]==other.pelem[i]) ++i;
+		if(i==n) return true;
 		for(auto& q : qset) {
 			if(! other.contains(q))
 				return false;
@@ -604,15 +885,25 @@ public:
 	/// A hash code for the set
 	inline size_t hash_code() const { return hcode; }
 
+	/**
+		Make the elements of this set refcount-free.
+
+		@see qualifier::immortalize()
+	  */
+	void immortalize() const {
+		for(auto& q : qset) q.immortalize();
+		for(auto& q : pelem) q.immortalize();
+	}
+
 private:
 	struct hash_types {
 		inline size_t operator()(const qualifier& q) const {
-			return q.type().hash_code();
+			return u::mix_hash(q.type_id());
 		}
 	};
 	struct equal_types {
 		inline bool operator()(const qualifier& q1, const qualifier& q2) const {
-			return q1.type()==q2.type();
+			return q1.same_type(q2);
 		}
 	};
 public:
@@ -641,8 +932,9 @@ public:
 	bool delete_similar(const qualifier& q) {
 		auto it = qset.find(q);
 		if(it != qset.end()) {
-			hcode ^= (*it).hash_code();
+			hcode -= (*it).hash_code();
 			qset.erase(it);
+			pack();
 			return true;
 		}
 		return false;
@@ -657,8 +949,9 @@ public:
 	bool delete_equal(const qualifier& q) {
 		auto it = qset.find(q);
 		if(it != qset.end() and (*it)==q) {
-			hcode ^= (*it).hash_code();
+			hcode -= (*it).hash_code();
 			qset.erase(it);
+			pack();
 			return true;
 		}
 		return false;
@@ -672,7 +965,8 @@ public:
 		delete_similar(q);
 		auto ret [[maybe_unused]] = qset.insert(q);
 		assert(ret.second);
-		hcode ^= q.hash_code();
+		hcode += q.hash_code();
+		pack();
 	}
 
 	/**
@@ -697,19 +991,47 @@ public:
 	  */
 	void clear() {
 		qset.clear(); hcode=0;
+		pack();
 	}
 
 
 private:
 	set_type qset;
 	size_t hcode;
+
+	// Packed copy of the elements, sorted by hash code, for the pre-filters
+	std::vector<size_t> phash;      // element hash codes
+	std::vector<size_t> ptype;      // element type ids
+	std::vector<qualifier> pelem;   // the elements
+	std::vector<bool> pexact;       // true if matching is equality
+	size_t ncustom = 0;             // number of elements with custom matching
+
+	void pack() {
+		pelem.assign(qset.begin(), qset.end());
+		std::sort(pelem.begin(), pelem.end(),
+			[](const qualifier& a, const qualifier& b) { return a.hash_code() < b.hash_code(); });
+		const size_t n = pelem.size();
+		phash.resize(n);
+		ptype.resize(n);
+		pexact.resize(n);
+		ncustom = 0;
+		for(size_t i=0; i<n; ++i) {
+			phash[i] = pelem[i].hash_code();
+			ptype[i] = pelem[i].type_id();
+			pexact[i] = pelem[i].matches_by_equality();
+			if(! pexact[i]) ++ncustom;
+		}
+	}
+
+	// The set hash is the sum of the (well-mixed) element hashes: it does
+	// not depend on order and is updated incrementally, but unlike a XOR,
+	// sets differing by a symmetric exchange of elements do not collide.
 	void compute_hash() {
-		// q: initialize the hash code of the empty set to a
-		// weird value (doesn't matter which)?
 		size_t seed = 0;
 		for(auto& q : qset)
-			seed ^= q.hash_code();
+			seed += q.hash_code();
 		hcode = seed;
+		pack();
 	}
 
 	auto find_exact(const qualifier& q) {
@@ -730,6 +1052,170 @@ inline std::ostream& operator<<(std::ostream& s, const qualifiers& q)
 
 
 
+/**
+	A memo table for the results of `qualifiers::matches()`.
+
+	When enabled, the results of matching sets that contain elements with
+	custom matching are cached. Sets without custom matching are matched by
+	equality, which is cheaper than a lookup, and are not cached.
+
+	There are two levels: a small direct-mapped cache per thread, which is
+	read and written without locks or atomic read-modify-writes, and a
+	larger shared table, split into shards with a mutex each. Both are bounded;
+	a new entry replaces the entry in its slot. Entries are keyed by the
+	hash codes of the two sets. They also hold references to the element
+	states of the sets, so that a hit is confirmed by comparing pointers,
+	and hash collisions cannot return wrong results. Thus, a hit requires
+	sets whose elements share their states with the memoized ones (as do
+	copies of a set, or sets whose elements have been compared equal);
+	other equal sets miss, and replace the entry. Sets with more than
+	`max_size` elements are not memoized.
+
+	Changes to the semantics of matching (e.g., declarations in a qualifier
+	hierarchy) must call `invalidate()`, which discards all entries by
+	advancing a generation counter.
+	```
+	match_memo::enable();
+	...
+	auto st = match_memo::stats();
+	```
+  */
+class match_memo
+{
+public:
+	/// Lookup counters
+	struct statistics {
+		size_t front_hits;   //< hits in the cache of the calling thread
+		size_t shared_hits;  //< hits in the shared table
+		size_t misses;       //< lookups that ran the matching algorithm
+	};
+
+	/// Enable or disable memoization
+	static void enable(bool on = true) {
+		if(on) invalidate();
+		active.store(on, std::memory_order_relaxed);
+	}
+
+	/// Return true if memoization is enabled
+	static inline bool enabled() { return active.load(std::memory_order_relaxed); }
+
+	/// Discard all memoized results
+	static void invalidate() { gen.fetch_add(1, std::memory_order_relaxed); }
+
+	/**
+		Return the lookup counters.
+
+		The front hits are those of the calling thread.
+	  */
+	static statistics stats() {
+		return { front_hits, shared_hits.load(), misses.load() };
+	}
+
+	/// Reset the shared counters and those of the calling thread
+	static void reset_stats() {
+		front_hits = 0;
+		shared_hits.store(0);
+		misses.store(0);
+	}
+
+private:
+	friend class qualifiers;
+
+	static constexpr size_t front_size = 128;
+	static constexpr size_t nshards = 16;
+	static constexpr size_t shard_size = 128;
+	static constexpr size_t max_size = 8;
+
+	struct entry {
+		size_t gen = 0;   // 0: empty
+		size_t ha = 0, hb = 0;
+		size_t na = 0, nb = 0;
+		bool result = false;
+		qualifier elems[2*max_size];   // keep the states alive
+
+		inline bool holds(size_t g, const qualifiers& x, const qualifiers& y) const {
+			if(gen!=g || ha!=x.hcode || hb!=y.hcode || na!=x.size() || nb!=y.size())
+				return false;
+			for(size_t i=0; i<na; ++i)
+				if(elems[i].ptr != x.pelem[i].ptr) return false;
+			for(size_t i=0; i<nb; ++i)
+				if(elems[na+i].ptr != y.pelem[i].ptr) return false;
+			return true;
+		}
+		inline void assign(size_t g, const qualifiers& x, const qualifiers& y, bool r) {
+			gen = g; ha = x.hcode; hb = y.hcode;
+			na = x.size(); nb = y.size();
+			std::copy(x.pelem.begin(), x.pelem.end(), elems);
+			std::copy(y.pelem.begin(), y.pelem.end(), elems+na);
+			std::fill(elems+na+nb, elems+2*max_size, qualifier());
+			result = r;
+		}
+	};
+
+	struct shard {
+		std::mutex mutex;
+		std::vector<entry> entries;   // allocated at first use
+	};
+
+	static bool lookup(const qualifiers& x, const qualifiers& y)
+	{
+		if(x.size() > max_size || y.size() > max_size)
+			return x.match_elements(y);
+
+		const size_t g = gen.load(std::memory_order_relaxed);
+		size_t key = u::mix_hash(x.hash_code());
+		u::combine_hash(key, y.hash_code());
+
+		thread_local std::vector<entry> front(front_size);
+		entry& fe = front[key % front_size];
+		if(fe.holds(g, x, y)) {
+			++front_hits;
+			return fe.result;
+		}
+
+		shard& sh = shards[(key / front_size) % nshards];
+		const size_t slot = (key / (front_size*nshards)) % shard_size;
+		{
+			std::lock_guard<std::mutex> lock(sh.mutex);
+			if(! sh.entries.empty() && sh.entries[slot].holds(g, x, y)) {
+				bool r = sh.entries[slot].result;
+				shared_hits.fetch_add(1, std::memory_order_relaxed);
+				fe.assign(g, x, y, r);
+				return r;
+			}
+		}
+
+		misses.fetch_add(1, std::memory_order_relaxed);
+		bool r = x.match_elements(y);
+		{
+			std::lock_guard<std::mutex> lock(sh.mutex);
+			if(sh.entries.empty()) sh.entries.resize(shard_size);
+			sh.entries[slot].assign(g, x, y, r);
+		}
+		fe.assign(g, x, y, r);
+		return r;
+	}
+
+	static inline std::atomic<bool> active {false};
+	static inline std::atomic<size_t> gen {1};
+	static inline shard shards[nshards];
+
+	static inline thread_local size_t front_hits = 0;
+	static inline std::atomic<size_t> shared_hits {0}, misses {0};
+};
+
+
+inline bool qualifiers::matches(const qualifiers& other) const
+{
+	if(ncustom==0)
+		return (*this)==other;
+	if(match_memo::enabled())
+		return match_memo::lookup(*this, other);
+	return match_elements(other);
+}
+
+
+
 /**
 	An unordered map type with qualifiers sets as keys.
   */
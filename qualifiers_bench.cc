@@ -0,0 +1,402 @@
+//
+// Micro-benchmarks for qualifier sets.
+//
+// Build with `make qualifiers_bench` and run without arguments.
+// The timing benchmarks report nanoseconds per operation; the hash
+// quality benchmark reports collisions and hash table probe lengths, and
+// the memoized matching benchmark reports hit rates and throughput.
+//
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <unordered_set>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+
+#include <boost/functional/hash.hpp>
+
+#include "cdi.hh"
+
+using namespace cdi;
+using std::vector;
+using std::string;
+
+DEFINE_QUALIFIER(Name, string, const string&)
+DEFINE_QUALIFIER(Size, size_t, size_t)
+DEFINE_QUALIFIER(Version, int, int)
+DEFINE_QUALIFIER(Shard, int, int)
+DEFINE_QUALIFIER(Region, string, const string&)
+DEFINE_VOID_QUALIFIER(Primary)
+DEFINE_VOID_QUALIFIER(Secondary)
+DEFINE_VOID_QUALIFIER(Cached)
+DEFINE_VOID_QUALIFIER(Remote)
+DEFINE_VOID_QUALIFIER(Local)
+DEFINE_VOID_QUALIFIER(Pooled)
+DEFINE_VOID_QUALIFIER(Traced)
+DEFINE_VOID_QUALIFIER(Mocked)
+
+// A qualifier with a (moderately) expensive custom matching: a path prefix
+DEFINE_QUALIFIER_CUSTOM(Under, string, const string&,
+	bool matches(const qual_base& other) const override {
+		auto o = dynamic_cast<const QUAL_CLASS(Under)*>(&other);
+		return o && o->value().compare(0, value().size(), value())==0;
+	}
+)
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+// Keep the optimizer from discarding results
+volatile size_t sink;
+
+template <typename F>
+double ns_per_op(size_t iters, F&& f)
+{
+	size_t acc = 0;
+	auto start = bench_clock::now();
+	for(size_t i=0; i<iters; ++i)
+		acc += f(i);
+	auto stop = bench_clock::now();
+	sink = acc;
+	return std::chrono::duration<double, std::nano>(stop-start).count() / iters;
+}
+
+// The element-wise algorithms, without the hash pre-filter
+bool naive_equal(const qualifiers& a, const qualifiers& b)
+{
+	if(a.size()!=b.size()) return false;
+	for(auto& q : a)
+		if(! b.contains(q)) return false;
+	return true;
+}
+
+bool naive_matches(const qualifiers& a, const qualifiers& b)
+{
+	for(auto& x : a) {
+		bool matched=false;
+		for(auto& y : b)
+			if(x.matches(y)) { matched=true; break; }
+		if(! matched) return false;
+	}
+	for(auto& y : b) {
+		bool matched=false;
+		for(auto& x : a)
+			if(x.matches(y)) { matched=true; break; }
+		if(! matched) return false;
+	}
+	return true;
+}
+
+// A set of the given size, mimicking resource annotations
+qualifiers make_set(size_t size, size_t variant)
+{
+	vector<qualifier> pool = {
+		Name("component-" + std::to_string(variant % 7)),
+		Global, Primary, Version(int(variant % 3)), Region("eu-west"),
+		Size(64), Cached, Remote, Secondary
+	};
+	qualifiers q({});
+	for(size_t i=0; i<size && i<pool.size(); ++i)
+		q.update(pool[i]);
+	return q;
+}
+
+void bench_set_sizes(bool with_all)
+{
+	const size_t iters = 1000000;
+	std::cout << "size  eq-hit eq-miss naive-hit naive-miss  match-hit match-miss naive-hit naive-miss\n";
+	for(size_t n : {1, 2, 3, 4, 6, 8}) {
+		// distinct objects with equal values, as produced by separate declarations
+		qualifiers a = make_set(n, 1), b = make_set(n, 1), c = make_set(n, 2);
+		qualifiers a2 = make_set(n, 1), b2 = make_set(n, 1), c2 = make_set(n, 2);
+		if(with_all) { a.update(All); a2.update(All); }
+
+		auto eq = [&](const qualifiers& x, const qualifiers& y) {
+			return ns_per_op(iters, [&](size_t) { return x==y; });
+		};
+		auto neq = [&](const qualifiers& x, const qualifiers& y) {
+			return ns_per_op(iters, [&](size_t) { return naive_equal(x, y); });
+		};
+		auto match = [&](const qualifiers& x, const qualifiers& y) {
+			return ns_per_op(iters, [&](size_t) { return x.matches(y); });
+		};
+		auto nmatch = [&](const qualifiers& x, const qualifiers& y) {
+			return ns_per_op(iters, [&](size_t) { return naive_matches(x, y); });
+		};
+
+		std::cout << std::setw(4) << n << std::fixed << std::setprecision(1)
+			<< std::setw(8) << eq(a, b) << std::setw(8) << eq(a, c)
+			<< std::setw(10) << neq(a2, b2) << std::setw(11) << neq(a2, c2)
+			<< std::setw(11) << match(a, b) << std::setw(11) << match(a, c)
+			<< std::setw(10) << nmatch(a2, b2) << std::setw(11) << nmatch(a2, c2)
+			<< '\n';
+	}
+}
+
+
+//
+// Hash quality
+//
+
+// The hashing scheme used before mixed set hashes, reconstructed
+size_t legacy_element_hash(const qualifier& q, size_t vhash)
+{
+	size_t seed = 0;
+	boost::hash_combine(seed, q.type().hash_code());
+	boost::hash_combine(seed, vhash);
+	return seed;
+}
+
+size_t legacy_rid_hash(std::type_index ti, size_t set_hash)
+{
+	size_t seed = 0;
+	boost::hash_combine(seed, ti.hash_code());
+	boost::hash_combine(seed, set_hash);
+	return seed;
+}
+
+// A resource id, together with its hash under the legacy scheme
+struct sample
+{
+	resourceid rid;
+	size_t legacy;      // hash of the resource id
+	size_t legacy_set;  // hash of the qualifiers
+};
+
+struct sample_builder
+{
+	std::type_index rtype = typeid(int);
+	qualifiers q {};
+	size_t legacy_set = 0;
+
+	sample_builder& add(const qualifier& x, size_t vhash = 0) {
+		q.update(x);
+		legacy_set ^= legacy_element_hash(x, vhash);
+		return *this;
+	}
+	sample_builder& value(const qualifier& x, int v) { return add(x, std::hash<int>()(v)); }
+	sample_builder& value(const qualifier& x, const string& v) { return add(x, std::hash<string>()(v)); }
+
+	sample make() const {
+		return { resourceid(rtype, q), legacy_rid_hash(rtype, legacy_set), legacy_set };
+	}
+};
+
+// Resource declarations of a typical application
+vector<sample> declarations()
+{
+	vector<sample> ret;
+	const std::type_index types[] = { typeid(int), typeid(double), typeid(string), typeid(vector<int>) };
+	for(auto ti : types)
+		for(int k=0; k<500; ++k) {
+			sample_builder b;
+			b.rtype = ti;
+			string name = "component-" + std::to_string(k);
+			b.value(Name(name), name).value(Version(k % 4), k % 4);
+			b.add(k % 2 ? New : Global);
+			if(k % 3 == 0) b.add(Primary);
+			ret.push_back(b.make());
+		}
+	return ret;
+}
+
+// Three small integer-valued qualifiers on a grid
+vector<sample> grid()
+{
+	vector<sample> ret;
+	for(int v=0; v<16; ++v)
+		for(int sz=0; sz<16; ++sz)
+			for(int sh=0; sh<16; ++sh) {
+				sample_builder b;
+				b.value(Version(v), v).add(Size(sz), std::hash<size_t>()(sz))
+					.value(Shard(sh), sh);
+				ret.push_back(b.make());
+			}
+	return ret;
+}
+
+// All combinations of eight flags, with a version
+vector<sample> flags()
+{
+	const qualifier flag[] = { Primary, Secondary, Cached, Remote, Local, Pooled, Traced, Mocked };
+	vector<sample> ret;
+	for(unsigned mask=0; mask < 256; ++mask)
+		for(int v=0; v<16; ++v) {
+			sample_builder b;
+			for(unsigned i=0; i<8; ++i)
+				if(mask & (1u<<i)) b.add(flag[i]);
+			b.value(Version(v), v);
+			ret.push_back(b.make());
+		}
+	return ret;
+}
+
+struct quality
+{
+	size_t collisions;   // samples sharing a hash value with an earlier sample
+	double avg_probe;    // mean chain length walked by successful lookups
+	size_t max_chain;    // longest bucket chain
+	double pow2_probe;   // mean chain length, with a power-of-two table
+};
+
+// Mean chain length walked by successful lookups
+template <typename Index>
+double probe_length(const vector<size_t>& hashes, size_t nbuckets, Index index,
+	size_t* max_chain = nullptr)
+{
+	vector<size_t> chain(nbuckets, 0);
+	for(size_t h : hashes) ++chain[index(h)];
+	double probes = 0;
+	for(size_t c : chain) probes += c*(c+1)/2.0;
+	if(max_chain) *max_chain = *std::max_element(chain.begin(), chain.end());
+	return probes / hashes.size();
+}
+
+// The map's own bucket count (prime, in libstdc++) and a power-of-two
+// table of similar size, as used by other hash table implementations
+quality measure(const vector<size_t>& hashes, size_t nbuckets)
+{
+	std::unordered_set<size_t> distinct(hashes.begin(), hashes.end());
+	quality q;
+	q.collisions = hashes.size() - distinct.size();
+	q.avg_probe = probe_length(hashes, nbuckets,
+		[nbuckets](size_t h) { return h % nbuckets; }, &q.max_chain);
+	size_t pow2 = 1;
+	while(pow2 < nbuckets) pow2 <<= 1;
+	q.pow2_probe = probe_length(hashes, pow2,
+		[pow2](size_t h) { return h & (pow2-1); });
+	return q;
+}
+
+void bench_hash_quality()
+{
+	std::cout << "distribution  samples  scheme  collisions  avg-probe  max-chain  pow2-probe\n";
+	auto report = [](const char* name, const vector<sample>& samples) {
+		// use the bucket count of an actual resource map
+		resource_map<int> rms;
+		qualifiers_map<size_t> sets;  // distinct qualifier sets
+		vector<size_t> current, legacy, current_set, legacy_set;
+		for(auto& s : samples) {
+			rms.emplace(s.rid, 0);
+			current.push_back(s.rid.hash_code());
+			legacy.push_back(s.legacy);
+			sets.emplace(s.rid.quals(), s.legacy_set);
+		}
+		for(auto& [q, h] : sets) {
+			current_set.push_back(q.hash_code());
+			legacy_set.push_back(h);
+		}
+		size_t nb = rms.bucket_count();
+		auto row = [&](const char* scheme, const quality& q, size_t n) {
+			std::cout << std::left << std::setw(14) << name << std::right
+				<< std::setw(7) << n << "  " << std::setw(6) << scheme
+				<< std::setw(12) << q.collisions
+				<< std::setw(11) << std::setprecision(2) << q.avg_probe
+				<< std::setw(11) << q.max_chain
+				<< std::setw(12) << q.pow2_probe << '\n';
+		};
+		row("legacy", measure(legacy, nb), legacy.size());
+		row("mixed", measure(current, nb), current.size());
+		// the distinct qualifier sets alone, as keys of a qualifiers_map
+		row("legacy-q", measure(legacy_set, nb), legacy_set.size());
+		row("mixed-q", measure(current_set, nb), current_set.size());
+	};
+	report("declarations", declarations());
+	report("grid", grid());
+	report("flags", flags());
+}
+
+
+// Repeated matching of a working set of (pattern, target) pairs, as done
+// when resolving the same lookups over and over.
+void bench_match_memo(size_t npairs)
+{
+	vector<qualifiers> patterns, targets;
+	for(size_t i=0; i<npairs; ++i) {
+		patterns.push_back(make_set(4, i));
+		patterns.back().update(Under("/srv/" + std::to_string(i % 32)));
+		targets.push_back(make_set(4, i));
+		targets.back().update(Under("/srv/" + std::to_string(i % 32) + "/data/" + std::to_string(i)));
+	}
+
+	// skewed: a few pairs are queried most of the time
+	auto pick = [&](size_t i) { size_t r = (i * 2654435761u) % npairs; return (r * r) / npairs; };
+
+	const size_t iters = 2000000;
+	auto run = [&]() {
+		return ns_per_op(iters, [&](size_t i) {
+			size_t k = pick(i);
+			return size_t(patterns[k].matches(targets[k]));
+		});
+	};
+
+	match_memo::enable(false);
+	double off = run();
+	match_memo::enable(true);
+	match_memo::reset_stats();
+	double on = run();
+	auto st = match_memo::stats();
+	double total = double(st.front_hits + st.shared_hits + st.misses);
+
+	std::cout << std::fixed << std::setprecision(1)
+		<< "pairs " << npairs << ", queries " << iters << '\n'
+		<< "  memo off: " << std::setw(7) << off << " ns/op\n"
+		<< "  memo on:  " << std::setw(7) << on << " ns/op"
+		<< "   front hits " << 100.0*st.front_hits/total << "%"
+		<< ", shared hits " << 100.0*st.shared_hits/total << "%"
+		<< ", misses " << 100.0*st.misses/total << "%\n";
+	if(npairs > 64) return;
+
+	// throughput with several threads sharing the table
+	auto throughput = [&](size_t nthreads) {
+		std::atomic<size_t> matched {0};
+		auto start = bench_clock::now();
+		vector<std::thread> threads;
+		for(size_t t=0; t<nthreads; ++t)
+			threads.emplace_back([&, t]() {
+				// private copies: matching merges qualifier states
+				vector<qualifiers> p(patterns), q(targets);
+				size_t acc = 0;
+				for(size_t i=0; i<iters/4; ++i) {
+					size_t k = pick(i + t*7919);
+					acc += p[k].matches(q[k]);
+				}
+				matched += acc;
+			});
+		for(auto& th : threads) th.join();
+		double secs = std::chrono::duration<double>(bench_clock::now()-start).count();
+		sink = matched;
+		return (nthreads * (iters/4)) / secs / 1e6;
+	};
+	std::cout << "  throughput (Mops/s)  memo off  memo on\n" << std::setprecision(2);
+	for(size_t nthreads : {1, 2, 4, 8}) {
+		match_memo::enable(false);
+		double t_off = throughput(nthreads);
+		match_memo::enable(true);
+		double t_on = throughput(nthreads);
+		std::cout << "  " << std::setw(2) << nthreads << " threads"
+			<< std::setw(18) << t_off << std::setw(9) << t_on << '\n';
+	}
+	match_memo::enable(false);
+}
+
+} // end anonymous namespace
+
+int main()
+{
+	std::cout << "== qualifiers: equality and matching (ns/op) ==\n";
+	bench_set_sizes(false);
+	std::cout << "\n== qualifiers with a custom-matching element (All) ==\n";
+	bench_set_sizes(true);
+	std::cout << "\n== memoized matching ==\n";
+	bench_match_memo(64);
+	bench_match_memo(512);
+	std::cout << "\n== hash quality of resource ids ==\n";
+	bench_hash_quality();
+	return 0;
+}
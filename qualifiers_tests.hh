@@ -2,6 +2,8 @@
 
 #include <cxxtest/TestSuite.h>
 
+#include <thread>
+
 #include "cdi.hh"
 
 //---------------------------------
@@ -276,7 +278,7 @@ public:
 	{
 		size_t chash = 0;
 		for(auto& q: Q)
-			chash ^= q.hash_code();
+			chash += q.hash_code();
 		TS_ASSERT_EQUALS(Q.hash_code(), chash);
 	}
 
@@ -334,6 +336,141 @@ public:
 		TS_ASSERT_EQUALS(q, qualifiers({All, Default, Name("gi")}));
 	}
 
+	// matches any Tag whose value has the same first letter
+	DEFINE_QUALIFIER_CUSTOM(Initial, std::string, const std::string&,
+		bool matches(const qual_base& other) const override {
+			auto o = dynamic_cast<const QUAL_CLASS(Initial)*>(&other);
+			return o && o->value().substr(0,1)==value().substr(0,1);
+		}
+	)
+	DEFINE_QUALIFIER(A1, int, int)
+	DEFINE_QUALIFIER(A2, int, int)
+	DEFINE_QUALIFIER(A3, int, int)
+	DEFINE_QUALIFIER(A4, int, int)
+
+	void test_matches_by_equality()
+	{
+		TS_ASSERT(Default.matches_by_equality());
+		TS_ASSERT(Name("foo").matches_by_equality());
+		TS_ASSERT(! All.matches_by_equality());
+		TS_ASSERT(! Initial("foo").matches_by_equality());
+		// hand-written qualifier classes are conservatively custom
+		TS_ASSERT(! Point(1,2).matches_by_equality());
+	}
+
+	void test_prefilter_collisions()
+	{
+		// Point(1,2) and Point(2,1) have equal hash codes
+		TS_ASSERT_EQUALS(Point(1,2).hash_code(), Point(2,1).hash_code());
+		qualifiers p12 {Point(1,2), Default};
+		qualifiers p21 {Point(2,1), Default};
+		TS_ASSERT_DIFFERS(p12, p21);
+		TS_ASSERT(! p12.matches(p21));
+		TS_ASSERT(p12.matches(qualifiers({Default, Point(1.0,2.0)})));
+	}
+
+	void test_prefilter_large_sets()
+	{
+		qualifiers q1 {A1(1), A2(2), A3(3), A4(4), Name("foo"), Size(5), Default};
+		qualifiers q2 {Default, Size(5), Name("foo"), A4(4), A3(3), A2(2), A1(1)};
+		qualifiers q3 {A1(1), A2(2), A3(3), A4(4), Name("foo"), Size(6), Default};
+
+		TS_ASSERT_EQUALS(q1, q2);
+		TS_ASSERT_DIFFERS(q1, q3);
+		TS_ASSERT(q1.matches(q2));
+		TS_ASSERT(! q1.matches(q3));
+		TS_ASSERT(q1.contains_similar(Size(7)));
+		TS_ASSERT(! q1.contains_similar(Point(0,0)));
+
+		qualifiers c1 {A1(1), A2(2), A3(3), Initial("foo")};
+		qualifiers c2 {A1(1), A2(2), A3(3), Initial("far")};
+		qualifiers c3 {A1(1), A2(2), A3(3), Initial("bar")};
+		TS_ASSERT_DIFFERS(c1, c2);
+		TS_ASSERT(c1.matches(c2));
+		TS_ASSERT(! c1.matches(c3));
+
+		q1.update(Size(6));
+		TS_ASSERT_EQUALS(q1, q3);
+	}
+
+	void test_literals()
+	{
+		static_assert(u::type_id_of<QUAL_CLASS(cdi::Default)>() & u::static_type_ids);
+		static_assert(u::type_id_of<QUAL_CLASS(Toplevel)>()
+			!= u::type_id_of<QUAL_CLASS(cdi::Default)>());
+
+		// literals are not reference-counted
+		qualifier d = Default;
+		TS_ASSERT_EQUALS(d.get<qual_base>().use_count(), 0);
+		TS_ASSERT_EQUALS(d.get<qual_base>().get(),
+			&cdi::detail::qual_literal<QUAL_CLASS(cdi::Default)>);
+
+		// objects of literal types made at runtime are equal to the literal
+		qualifier d2 { new QUAL_CLASS(cdi::Default)() };
+		TS_ASSERT_EQUALS(d2.type_id(), Default.type_id());
+		TS_ASSERT_EQUALS(d2.hash_code(), Default.hash_code());
+		TS_ASSERT_EQUALS(d2, Default);
+		TS_ASSERT_EQUALS(d2.get<qual_base>().use_count(), 0);  // merged into the literal
+
+		TS_ASSERT(Default.same_type(d2));
+		TS_ASSERT(! Default.same_type(All));
+		TS_ASSERT(All.matches(Toplevel));
+		TS_ASSERT(qualifiers({Default, Toplevel}).contains_similar(Toplevel));
+	}
+
+	void test_match_memo()
+	{
+		// hits need shared element states; comparing equal elements
+		// (e.g., in matching) makes them share states anyway
+		qualifier memo = Name("memo");
+		qualifiers x {All, memo}, y {memo, Default};
+		qualifiers z {memo, Toplevel};
+		TS_ASSERT(x.matches(y));
+
+		match_memo::enable();
+		match_memo::reset_stats();
+		TS_ASSERT(x.matches(y));
+		TS_ASSERT(qualifiers(x).matches(qualifiers(y)));   // equal copies hit
+		TS_ASSERT(x.matches(z));
+		TS_ASSERT(! y.matches(x));     // no custom elements: not memoized
+		auto st = match_memo::stats();
+		TS_ASSERT_EQUALS(st.misses, 2);
+		TS_ASSERT_EQUALS(st.front_hits, 1);
+
+		// another thread finds the result in the shared table
+		std::thread([&]() {
+			TS_ASSERT(x.matches(y));
+			TS_ASSERT_EQUALS(match_memo::stats().front_hits, 0);
+		}).join();
+		TS_ASSERT_EQUALS(match_memo::stats().shared_hits, 1);
+
+		match_memo::invalidate();
+		TS_ASSERT(x.matches(y));
+		TS_ASSERT_EQUALS(match_memo::stats().misses, 3);
+
+		match_memo::enable(false);
+		TS_ASSERT(x.matches(y));
+		TS_ASSERT_EQUALS(match_memo::stats().misses, 3);
+	}
+
+	void test_type_ids()
+	{
+		// hand-written classes get the same id as those using qual_impl
+		TS_ASSERT_EQUALS(Point(1,2).type_id(), Point(3,4).type_id());
+		TS_ASSERT_EQUALS(Point(1,2).type_id(),
+			u::type_id_for(typeid(QUAL_CLASS(Point))));
+		TS_ASSERT_EQUALS(Name("a").type_id(), u::type_id_of<QUAL_CLASS(Name)>());
+		TS_ASSERT_DIFFERS(Name("a").type_id(), Size(1).type_id());
+		TS_ASSERT(u::type_of(Size(1).type_id()) == Size(1).type());
+		TS_ASSERT_LESS_THAN(Size(1).type_id(), u::registered_types());
+
+		resourceid r1(typeid(int), {Default});
+		resourceid r2(u::type_id_of<int>(), typeid(int), {Default});
+		TS_ASSERT_EQUALS(r1, r2);
+		TS_ASSERT_EQUALS(r1.hash_code(), r2.hash_code());
+		TS_ASSERT_DIFFERS(r1, resourceid(typeid(long), {Default}));
+	}
+
 
 };
 
@@ -0,0 +1,388 @@
+#pragma once
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <shared_mutex>
+#include <condition_variable>
+
+#include "scope.hh"
+
+//=================================
+//
+//  refresh scope
+//
+//=================================
+
+namespace cdi {
+
+
+/**
+	A scope whose instances are rebuilt periodically, off the hot path.
+
+	Resources in this scope are declared with the `Refresh` qualifier, and
+	given a refresh interval by `every()`:
+	```
+	resource<Credentials> creds({Refresh});
+	creds.provide(load_credentials, "/etc/app/creds");
+	RefreshScope::every(creds, std::chrono::minutes(5));
+	```
+	The first `get()` of such a resource builds its instance on the calling
+	thread, resolving its dependencies once (see `contextual::prebind()`);
+	as with any container call, it must not run concurrently with other
+	gets. After that, a background thread re-runs the provider, injectors and
+	initializer whenever the interval elapses, and publishes the new instance
+	atomically; readers never wait for a rebuild. The previous instance is
+	disposed after a grace period (see `set_grace()`), so that references
+	obtained by `get()` stay valid for at least that long. If a rebuild
+	throws, the previous instance is kept, and the rebuild is retried after
+	another interval.
+
+	Since rebuilds run on another thread, lifecycle calls must be safe to run
+	concurrently with readers, and the dependencies they were bound to must
+	stay alive. Resources in this scope without an interval behave as in
+	`GlobalScope`.
+
+	`clear()` disposes all instances and forgets the intervals;
+	`container::clear()` calls it.
+  */
+class RefreshScope
+{
+public:
+	/// The `Refresh` scope qualifier is a literal
+	typedef void static_id_tag;
+
+	/// The clock of intervals
+	typedef std::chrono::steady_clock clock;
+
+	/// Counters of the background activity
+	struct statistics {
+		size_t refreshed = 0;  //< instances rebuilt and published
+		size_t failed = 0;     //< rebuilds that threw
+		size_t disposed = 0;   //< replaced instances disposed
+	};
+
+	/**
+		Set the refresh interval of a resource.
+
+		@param r a resource in this scope
+		@param interval the time between rebuilds
+		@throws config_error if the resource is not in this scope, or it is
+		already instantiated
+	  */
+	template <typename Resource>
+	static void every(const Resource& r, clock::duration interval);
+
+	/**
+		Set the time a replaced instance is kept before it is disposed
+		(1 second by default).
+	  */
+	static void set_grace(clock::duration grace) {
+		state& s = st();
+		std::lock_guard<std::shared_mutex> lock(s.mutex);
+		s.grace = grace;
+	}
+
+	/** Return the counters of the background activity */
+	static statistics stats() {
+		state& s = st();
+		std::lock_guard<std::shared_mutex> lock(s.mutex);
+		return s.counters;
+	}
+
+	/**
+		Rebuild the instances whose interval has elapsed, and dispose the
+		replaced instances whose grace period is over.
+
+		This is what the background thread does; calling it directly is
+		mostly useful in tests.
+		@param now the current time
+	  */
+	static void run_due(clock::time_point now = clock::now());
+
+	static std::tuple<asset*, bool> get_asset(const resourceid& rid);
+
+	static void drop_asset(const resourceid& rid)
+	{
+		state& s = st();
+		std::lock_guard<std::shared_mutex> lock(s.mutex);
+		s.plain->drop(rid);
+	}
+
+	/**
+		Dispose all instances, and forget the refresh intervals.
+	  */
+	static void clear();
+
+private:
+	// the lifecycle of a refreshed resource, with its type erased
+	struct lifecycle {
+		std::function<std::any()> create;
+		std::function<void(std::any&)> dispose;
+	};
+
+	struct slot {
+		clock::duration interval;
+		std::function<lifecycle()> prebind;  // called on the first get
+		lifecycle lc;
+		std::unique_ptr<asset> owner;
+		std::atomic<asset*> current {nullptr};
+		clock::time_point due;
+		bool building = false;    // the first instance
+		bool removed = false;   // by clear(), while rebuilding
+	};
+
+	struct retired {
+		std::unique_ptr<asset> ass;
+		std::function<void(std::any&)> dispose;
+		clock::time_point expires;
+	};
+
+	struct state {
+		std::shared_mutex mutex;
+		std::condition_variable_any wakeup;
+		resource_map<std::shared_ptr<slot>> slots;   // guarded by mutex
+		std::vector<retired> retiring;               // guarded by mutex
+		std::unique_ptr<context> plain = std::make_unique<context>();  // guarded by mutex
+		clock::duration grace = std::chrono::seconds(1);
+		statistics counters;
+		std::thread worker;
+		bool stopping = false;
+
+		state() {
+			// instances may depend on global ones
+			providence().on_clear(&RefreshScope::clear);
+		}
+
+		~state() {
+			{
+				std::lock_guard<std::shared_mutex> lock(mutex);
+				stopping = true;
+			}
+			wakeup.notify_all();
+			if(worker.joinable()) worker.join();
+		}
+	};
+
+	static state& st() {
+		static state s;
+		return s;
+	}
+
+	static void start(state& s) {
+		if(! s.worker.joinable())
+			s.worker = std::thread(work);
+	}
+
+	// the background thread
+	static void work()
+	{
+		state& s = st();
+		std::unique_lock<std::shared_mutex> lock(s.mutex);
+		while(! s.stopping) {
+			clock::time_point next = clock::time_point::max();
+			for(auto& [rid, sl] : s.slots)
+				if(sl->current.load(std::memory_order_relaxed))
+					next = std::min(next, sl->due);
+			for(auto& r : s.retiring)
+				next = std::min(next, r.expires);
+
+			if(next > clock::now()) {
+				if(next==clock::time_point::max())
+					s.wakeup.wait(lock);
+				else
+					s.wakeup.wait_until(lock, next);
+				continue;
+			}
+			lock.unlock();
+			run_due();
+			lock.lock();
+		}
+	}
+
+	static void publish(state& s, slot& sl, std::unique_ptr<asset> ass, clock::time_point now)
+	{
+		sl.current.store(ass.get(), std::memory_order_release);
+		if(sl.owner)
+			s.retiring.push_back({ std::move(sl.owner), sl.lc.dispose, now + s.grace });
+		sl.owner = std::move(ass);
+		sl.due = now + sl.interval;
+	}
+
+	static std::unique_ptr<asset> build(const lifecycle& lc)
+	{
+		auto ass = std::make_unique<asset>(std::any());
+		ass->object() = lc.create();
+		ass->set_phase(Phase::created);
+		return ass;
+	}
+};
+
+
+inline const qualifier Refresh { detail::qual_literal< scope_proxy<RefreshScope> > };
+
+
+template <typename Resource>
+void RefreshScope::every(const Resource& r, clock::duration interval)
+{
+	typedef typename Resource::instance_type instance_type;
+	auto rm = declare(r);
+	if(rm->scope_qual()!=Refresh)
+		throw config_error(u::str_builder() << "Resource " << rm->rid()
+			<< " is not in RefreshScope");
+
+	state& s = st();
+	std::lock_guard<std::shared_mutex> lock(s.mutex);
+	auto& sl = s.slots[rm->rid()];
+	if(! sl) sl = std::make_shared<slot>();
+	else if(sl->current.load() || sl->building)
+		throw config_error(u::str_builder() << "Cannot set the refresh interval of "
+			<< rm->rid() << " after it is instantiated");
+	sl->interval = interval;
+	sl->prebind = [rm]() -> lifecycle {
+		auto lc = rm->prebind();
+		return {
+			[lc]() { return std::any(lc->create()); },
+			[lc](std::any& obj) { lc->dispose(std::any_cast<instance_type&>(obj)); }
+		};
+	};
+	start(s);
+}
+
+
+inline std::tuple<asset*, bool> RefreshScope::get_asset(const resourceid& rid)
+{
+	state& s = st();
+	std::shared_ptr<slot> sl;
+	{
+		std::shared_lock<std::shared_mutex> lock(s.mutex);
+		auto iter = s.slots.find(rid);
+		if(iter==s.slots.end()) {
+			lock.unlock();
+			std::lock_guard<std::shared_mutex> xlock(s.mutex);
+			return s.plain->get(rid);
+		}
+		sl = iter->second;
+		if(asset* ass = sl->current.load(std::memory_order_acquire))
+			return { ass, false };
+	}
+
+	// first get: build the instance on this thread
+	{
+		std::lock_guard<std::shared_mutex> lock(s.mutex);
+		if(sl->building)
+			throw instantiation_error(u::str_builder()
+				<< "Cyclical dependency in instantiating " << rid);
+		sl->building = true;
+	}
+
+	lifecycle lc;
+	std::unique_ptr<asset> ass;
+	try {
+		lc = sl->prebind();
+		ass = build(lc);
+	} catch(...) {
+		{
+			std::lock_guard<std::shared_mutex> lock(s.mutex);
+			sl->building = false;
+		}
+		std::throw_with_nested(instantiation_error(u::str_builder()
+			<< "Error while instantiating " << rid));
+	}
+
+	asset* ret = ass.get();
+	{
+		std::unique_lock<std::shared_mutex> lock(s.mutex);
+		sl->building = false;
+		if(sl->removed) {
+			lock.unlock();
+			throw instantiation_error(u::str_builder()
+				<< "RefreshScope was cleared while instantiating " << rid);
+		}
+		sl->lc = std::move(lc);
+		publish(s, *sl, std::move(ass), clock::now());
+	}
+	s.wakeup.notify_all();
+	return { ret, false };
+}
+
+
+inline void RefreshScope::run_due(clock::time_point now)
+{
+	state& s = st();
+
+	// collect the due work under the lock, and run it without
+	std::vector<std::shared_ptr<slot>> due;
+	std::vector<retired> expired;
+	{
+		std::lock_guard<std::shared_mutex> lock(s.mutex);
+		for(auto& [rid, sl] : s.slots)
+			if(sl->current.load(std::memory_order_relaxed) && sl->due <= now) {
+				due.push_back(sl);
+				sl->due = clock::time_point::max();  // not due while rebuilding
+			}
+		auto keep = std::partition(s.retiring.begin(), s.retiring.end(),
+			[now](const retired& r) { return r.expires > now; });
+		std::move(keep, s.retiring.end(), std::back_inserter(expired));
+		s.retiring.erase(keep, s.retiring.end());
+	}
+
+	for(auto& sl : due) {
+		std::unique_ptr<asset> ass;
+		try {
+			ass = build(sl->lc);
+		} catch(...) { }
+
+		std::lock_guard<std::shared_mutex> lock(s.mutex);
+		if(sl->removed) {
+			if(ass) expired.push_back({ std::move(ass), sl->lc.dispose, now });
+		} else if(ass) {
+			publish(s, *sl, std::move(ass), clock::now());
+			++ s.counters.refreshed;
+		} else {
+			sl->due = clock::now() + sl->interval;
+			++ s.counters.failed;
+		}
+	}
+
+	for(auto& r : expired) {
+		try {
+			if(r.dispose) r.dispose(r.ass->object());
+		} catch(...) { }
+	}
+	if(! expired.empty()) {
+		std::lock_guard<std::shared_mutex> lock(s.mutex);
+		s.counters.disposed += expired.size();
+	}
+}
+
+
+inline void RefreshScope::clear()
+{
+	state& s = st();
+	std::vector<retired> disposing;
+	std::unique_ptr<context> plain = std::make_unique<context>();
+	{
+		std::lock_guard<std::shared_mutex> lock(s.mutex);
+		for(auto& [rid, sl] : s.slots) {
+			sl->current.store(nullptr, std::memory_order_relaxed);
+			sl->removed = true;
+			if(sl->owner)
+				disposing.push_back({ std::move(sl->owner), sl->lc.dispose, {} });
+		}
+		s.slots.clear();
+		std::move(s.retiring.begin(), s.retiring.end(), std::back_inserter(disposing));
+		s.retiring.clear();
+		s.counters = statistics();
+		s.plain.swap(plain);
+	}
+	for(auto& r : disposing)
+		if(r.dispose) r.dispose(r.ass->object());
+	plain->clear();
+}
+
+
+} // end namespace cdi
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include <thread>
+
+#include "cdi.hh"
+#include "refresh.hh"
+
+using namespace cdi;
+using namespace std;
+
+class RefreshSuite : public CxxTest::TestSuite
+{
+public:
+
+	void tearDown() {
+		providence().clear();
+	}
+
+	void test_refresh()
+	{
+		atomic<int> version {0}, disposed {0};
+		resource<shared_ptr<int>> r({Refresh});
+		r.provide([&]() { return make_shared<int>(++version); })
+		 .dispose([&](shared_ptr<int>&) { ++disposed; });
+		RefreshScope::every(r, chrono::hours(1));
+		TS_ASSERT_THROWS(RefreshScope::every(resource<int>({}), chrono::hours(1)), config_error);
+
+		const shared_ptr<int>& first = r.get();
+		TS_ASSERT_EQUALS(*first, 1);
+		TS_ASSERT_EQUALS(&r.get(), &first);
+		TS_ASSERT_THROWS(RefreshScope::every(r, chrono::hours(2)), config_error);
+
+		// not due yet
+		auto now = RefreshScope::clock::now();
+		RefreshScope::run_due(now);
+		TS_ASSERT_EQUALS(*r.get(), 1);
+
+		// rebuilt and swapped; the old instance survives its grace period
+		RefreshScope::run_due(now + chrono::hours(2));
+		TS_ASSERT_EQUALS(*r.get(), 2);
+		TS_ASSERT_EQUALS(*first, 1);
+		TS_ASSERT_EQUALS(disposed, 0);
+		TS_ASSERT_EQUALS(RefreshScope::stats().refreshed, 1);
+
+		// (this is also the next refresh)
+		RefreshScope::run_due(now + chrono::hours(3) + chrono::seconds(2));
+		TS_ASSERT_EQUALS(*r.get(), 3);
+		TS_ASSERT_EQUALS(disposed, 1);
+		TS_ASSERT_EQUALS(RefreshScope::stats().disposed, 1);
+
+		// the current and the retiring instances
+		RefreshScope::clear();
+		TS_ASSERT_EQUALS(disposed, 3);
+	}
+
+	void test_failed_refresh()
+	{
+		int calls = 0;
+		resource<int> r({Refresh});
+		r.provide([&]() { if(++calls > 1) throw runtime_error("down"); return 7; });
+		RefreshScope::every(r, chrono::hours(1));
+		TS_ASSERT_EQUALS(r.get(), 7);
+
+		RefreshScope::run_due(RefreshScope::clock::now() + chrono::hours(2));
+		TS_ASSERT_EQUALS(r.get(), 7);
+		TS_ASSERT_EQUALS(RefreshScope::stats().failed, 1);
+		TS_ASSERT_EQUALS(RefreshScope::stats().refreshed, 0);
+	}
+
+	void test_container_clear()
+	{
+		// the container clears the scope before the dependencies of its
+		// instances are disposed
+		int disposed = 0;
+		bool dep_alive = false;
+		resource<int*> dep({});
+		dep.provide([&]() { dep_alive = true; return new int(5); })
+		   .dispose([&](int* p) { dep_alive = false; delete p; });
+		resource<int> r({Refresh});
+		r.provide([](int* d) { return *d; }, dep)
+		 .dispose([&](int&) { TS_ASSERT(dep_alive); ++disposed; });
+		RefreshScope::every(r, chrono::hours(1));
+		TS_ASSERT_EQUALS(r.get(), 5);
+
+		providence().clear();
+		TS_ASSERT_EQUALS(disposed, 1);
+		TS_ASSERT(! dep_alive);
+	}
+
+	void test_background_refresh()
+	{
+		atomic<int> version {0};
+		resource<int> dep({});
+		dep.provide([]() { return 100; });
+		resource<int> r({Refresh});
+		r.provide([&](int base) { return base + ++version; }, dep);
+		RefreshScope::every(r, chrono::milliseconds(5));
+
+		TS_ASSERT_EQUALS(r.get(), 101);
+		for(int i=0; i<200 && r.get() < 103; ++i)
+			this_thread::sleep_for(chrono::milliseconds(5));
+		TS_ASSERT_LESS_THAN_EQUALS(103, r.get());
+	}
+
+	void test_plain_resources()
+	{
+		resource<string> r({Refresh});
+		r.provide([]() { return string("plain"); });
+		TS_ASSERT_EQUALS(r.get(), "plain");
+		TS_ASSERT_EQUALS(&r.get(), &r.get());
+	}
+};
@@ -18,6 +18,124 @@ std::ostream& operator<<(std::ostream&, const resourceid&);
 
 
 
+/**
+	Implementation of a resource id.
+
+	A resourceid is an untyped descriptor for resources. It can be
+	thought of as a pair of a type (described by a dense type id, see
+	`utilities::type_id_for()`) and a set of qualifiers.
+
+	@section perf Performance
+
+	Copying and/or moving a resourceid is the same as doing so on a std::shared_ptr.
+
+	A resource type is converted to a resourceid by a conversion operator
+	(e.g., `resource::operator const resourceid&()`).
+  */
+class resourceid
+{
+public:
+
+	/**
+		Construct a new resource id.
+		@param ti the type id of the resource
+		@param q the qualifiers of the resource
+	  */
+	resourceid(std::type_index ti, const qualifiers& q = {})
+	: sptr(std::make_shared<rid_impl>(u::type_id_for(ti), ti, q))
+	{ }
+
+	/**
+		Construct a new resource id, given the type id of the resource.
+		@param id the type id of the resource, as returned by `utilities::type_id_of()`
+		@param ti the type index of the resource
+		@param q the qualifiers of the resource
+	  */
+	resourceid(u::type_id id, std::type_index ti, const qualifiers& q)
+	: sptr(std::make_shared<rid_impl>(id, ti, q))
+	{ }
+
+	/// Equality comparison
+	inline bool operator==(const resourceid& other) const {
+		if(sptr == other.sptr)
+			return true;
+		if( sptr->hcode == other.sptr->hcode &&
+			sptr->tid == other.sptr->tid &&
+			sptr->quals == other.sptr->quals)
+		{
+			// combine into one state, unless pages must stay clean
+			if(detail::preforked) return true;
+			if(sptr.use_count() > other.sptr.use_count())
+				sptr = other.sptr;
+			else
+				other.sptr = sptr;
+			return true;
+		}
+		return false;
+	}
+
+	/// Inequality
+	inline bool operator!=(const resourceid& other) const {  return !operator==(other); }
+
+	/// hash code
+	inline size_t hash_code() const { return sptr->hcode; }
+
+	/// the type index of the resource
+	inline const std::type_index& type() const { return sptr->type; }
+
+	/// the type id of the resource
+	inline u::type_id type_id() const { return sptr->tid; }
+
+	/// the qualifiers of the resource
+	inline const qualifiers& quals() const { return sptr->quals; }
+
+	/**
+		Make this id, and its qualifiers, refcount-free.
+
+		@see utilities::make_immortal()
+	  */
+	void immortalize() const {
+		sptr->quals.immortalize();
+		sptr = u::make_immortal(sptr);
+	}
+
+private:
+	struct rid_impl
+	{
+		// cache the hcode for speed
+		const std::type_index type;   // for diagnostics
+		const u::type_id tid;
+		const qualifiers quals;
+		const size_t hcode;
+
+		inline rid_impl(u::type_id id, std::type_index ti, const qualifiers& q)
+		: type(ti), tid(id), quals(q), hcode(compute_hash(id, q)) { }
+
+		static size_t compute_hash(u::type_id id, const qualifiers& q)
+		{
+			size_t seed = u::mix_hash(id);
+			u::combine_hash(seed, q.hash_code());
+			return seed;
+		}
+	};
+
+	mutable std::shared_ptr<rid_impl> sptr;
+};
+
+/// Alias for set of `resourceid`s
+using resource_set = std::unordered_set<resourceid, utilities::hash_code<resourceid>>;
+
+/// Output streaming for resourceid
+inline std::ostream& operator<<(std::ostream& s, const resourceid& r)
+{
+	s << "RESOURCE(";
+	s << r.quals() << " ";
+	s << boost::core::demangle(r.type().name()) <<" )";
+	return s;
+}
+
+
+
 //=================================
 //
 // resources
@@ -84,24 +202,27 @@ struct resource
 
 	/// Construct an instance
 	inline resource(const qualifiers& _q)
-		: q(_q) { }
+		: q(_q), rid(u::type_id_of<resource_type>(), typeid(resource_type), q) { }
 
 	/// Construct an instance
 	inline resource(qualifiers&& _q)
-		: q(_q) { }
+		: q(_q), rid(u::type_id_of<resource_type>(), typeid(resource_type), q) { }
 
  	/// The qualifiers of the contextual object type
  	inline const qualifiers& quals() const { return q; }
 
+ 	/// A resourceid for this resource
+ 	inline const resourceid& id() const { return rid; }
+
+ 	/// Conversion to resourceid; the id is computed once, at construction
+ 	inline operator const resourceid&() const { return rid; }
+
  	//===================================================
  	// The following methods are all defined externally
  	// and constitute the main user entries to the
  	// container API.
  	//=================================================
 
- 	/// A resourceid for this resource
- 	resourceid id() const;
-
  	/**
  		Return a resource manager for this resource.
 
@@ -184,6 +305,7 @@ struct resource
 		@param func the function called by the new disposer
 		@param args a sequence of arguments to be given to func at invocation
 		@throws config_error if a disposer already exists for this resource
+		@throws config_error if the resource is deduplicated (see `dedup()`)
 
 		This call registers a dispose function for this resource. When method
 		dispose(obj) is invoked on an instance `obj` of this resource,
@@ -197,117 +319,69 @@ struct resource
 	template <typename Callable, typename...Args>
 	const resource_type& dispose(Callable func, Args&& ... args ) const;
 
-private:
-	qualifiers q;
-};
-
-
-
-
-
-/**
-	Implementation of a resource id.
-
-	A resourceid is an untyped descriptor for resources. It can be
-	thought of as a pair of a type (described by a std::type_index) and a
-	set of qualifiers.
-
-	@section perf Performance
-
-	Copying and/or moving a resourceid is the same as doing so on a std::shared_ptr.
-  */
-class resourceid
-{
-public:
-
 	/**
-		Construct a new resource id.
-		@param ti the type id of the resource
-		@param q the qualifiers of the resource
+		Require the instances of this resource to be disposed on the thread
+		that deactivates their scope, even when asynchronous disposal is
+		enabled (see `reclaimer`).
+
+		This is needed when the disposer is not safe to run on another
+		thread, e.g., when it uses thread-local state.
 	  */
-	resourceid(std::type_index ti, const qualifiers& q = {})
-	: sptr(std::make_shared<rid_impl>(ti,q))
-	{ }
+	const resource_type& dispose_synchronously() const;
 
 	/**
-		Construct a new resource id.
-		@param ti the type id of the resource
-		@param q the qualifiers of the resource
+		Declare that the lifecycle calls of this resource have no side
+		effects, so that instances may be made before they are asked for,
+		and thrown away unused (see `speculation`).
 	  */
-	template <typename Instance>
-	resourceid(const resource<Instance>& r)
-	: resourceid(typeid(resource<Instance>), r.quals())
-	{ }
+	const resource_type& pure() const;
 
-	/// Equality comparison
-	inline bool operator==(const resourceid& other) const {
-		if(sptr == other.sptr)
-			return true;
-		if( sptr->hcode == other.sptr->hcode &&
-			sptr->type == other.sptr->type &&
-			sptr->quals == other.sptr->quals)
-		{
-			if(sptr.use_count() > other.sptr.use_count())
-				sptr = other.sptr;
-			else
-				other.sptr = sptr;
-			return true;
-		}
-		return false;
-	}
+	/**
+		Share instances that are equal in value.
 
-	/// Inequality
-	inline bool operator!=(const resourceid& other) const {  return !operator==(other); }
+		@tparam Hash the hash function of the values (`std::hash` by default)
+		@tparam Equal the equality of the values (`std::equal_to` by default)
+		@throws config_error if the resource has a disposer
 
-	/// hash code
-	inline size_t hash_code() const { return sptr->hcode; }
+		This is only available to resources whose instance type is a
+		`std::shared_ptr` to a const value. After it is called, each instance,
+		once injected and initialized, is replaced by a pointer to an equal
+		value already created (by any resource with the same instance type),
+		if one is alive. This saves memory when many contexts or qualified
+		resources hold the same immutable configuration.
 
-	/// the type id of the resource
-	inline const std::type_index& type() const { return sptr->type; }
+		Shared values are released with their last instance, and are never
+		disposed; a deduplicated resource cannot have a disposer.
+		```
+		resource<shared_ptr<const Config>> Cfg({Name("a")});
+		Cfg.provide(load_config, "a.conf").dedup();
+		```
+	  */
+	template <typename Hash = void, typename Equal = void>
+	const resource_type& dedup() const;
 
-	/// the qualifiers of the resource
-	inline const qualifiers& quals() const { return sptr->quals; }
+	/**
+		Declare this resource as an alias of another resource.
 
-private:
-	struct rid_impl
-	{
-		// cache the hcode for speed
-		const std::type_index type;
-		const qualifiers quals;
-		const size_t hcode;
+		@param target the resource aliased
+		@throws config_error if this resource is already declared
 
-		inline rid_impl(std::type_index ti, const qualifiers& q)
-		: type(ti), quals(q), hcode(compute_hash(ti, q)) { }
+		An alias shares the resource manager of its target, and in any
+		context, the same instance. It is resolved once, at this call, so that
+		getting an alias is exactly as costly as getting the target. Configuring
+		an alias (e.g., calling `provide()` on it) configures its target.
 
-		static size_t compute_hash(std::type_index ti, const qualifiers& q)
-		{
-			using u::hash_combine;
-			size_t seed = 0;
-			hash_combine(seed, ti.hash_code());
-			hash_combine(seed, q.hash_code());
-			return seed;
-		}
-	};
+		@see container::alias()
+	 */
+	const resource_type& alias_of(const resource_type& target) const;
 
-	mutable std::shared_ptr<rid_impl> sptr;
+private:
+	qualifiers q;
+	resourceid rid;
 };
 
-/// Alias for set of `resourceid`s
-using resource_set = std::unordered_set<resourceid, utilities::hash_code<resourceid>>;
 
-/// Output streaming for resourceid
-inline std::ostream& operator<<(std::ostream& s, const resourceid& r)
-{
-	s << "RESOURCE(";
-	s << r.quals() << " ";
-	s << boost::core::demangle(r.type().name()) <<" )";
-	return s;
-}
 
-template <typename Instance>
-resourceid resource<Instance>::id() const {
-	return resourceid(*this);
-}
 
 
 /**
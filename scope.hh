@@ -1,5 +1,16 @@
 #pragma once
 
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <shared_mutex>
+#include <unordered_set>
+#include <unordered_map>
+#include <memory_resource>
+#include <condition_variable>
+
 #include "container.hh"
 
 
@@ -34,7 +45,8 @@ public:
 	  */
 	std::tuple<asset*, bool> get(const resourceid& rid)
 	{
-		auto [iter, isnew] = asset_map.emplace(rid, std::any());
+		// try_emplace does not copy rid when it is already mapped
+		auto [iter, isnew] = asset_map.try_emplace(rid, std::any());
 		return { & iter->second, isnew };
 	}
 
@@ -53,23 +65,116 @@ public:
 	/**
 	   Empty the context, disposing all resource instances.
 
-	   This method is executed by the destructor as well.
+	   Instances are disposed before the instances they depend on (as far
+	   as these are in the same context). This method is executed by the
+	   destructor as well.
+
+	   If a disposer throws, the remaining instances are still disposed and
+	   the context is emptied; then the first error is rethrown.
 	  */
 	void clear() {
-		// call dispose on every object in the asset map
-		for(auto& [rid, ass] : asset_map) {
-			try {
-				contextual_base* rm = providence().at(rid);
-				rm->dispose(ass.object());
-			} catch(std::out_of_range) {
-				throw disposal_error(u::str_builder()
-					<<"Could not obtain resource manager for " << rid
-					<< " found in the context!");
-			}
+		if(asset_map.empty()) {
+			release();
+			return;
 		}
-		asset_map.clear();
+		lifecycle_observers& obs = providence().observers();
+		std::exception_ptr error;
+		dispose_each([&](const resourceid& rid, asset& ass) {
+			contextual_base* rm = manager_of(rid, ass);
+			rm->dispose(ass.object());
+			if(obs.observing(Event::disposed))
+				obs.notify(Event::disposed, rm, rm->scope_qual().type());
+		}, &error);
+		if(obs.observing())
+			obs.flush();
+		if(error) std::rethrow_exception(error);
+	}
+
+	/**
+		Dispose all resource instances, without notifying observers and
+		without accessing the container.
+
+		This is used by the `reclaimer` to dispose contexts on a background
+		thread; every asset must have its manager set.
+		@return the number of disposers that threw
+	  */
+	size_t dispose_detached() {
+		return dispose_each([](const resourceid&, asset& ass) {
+			ass.manager()->dispose(ass.object());
+		});
 	}
 
+	/**
+		Return true if some instance must be disposed synchronously.
+		@see contextual_base::sync_disposal()
+	  */
+	bool requires_sync_disposal() const {
+		for(auto& [rid, ass] : asset_map)
+			if(ass.manager()==nullptr || ass.manager()->sync_disposal())
+				return true;
+		return false;
+	}
+
+	/**
+		Move the contents of the context into another context, leaving this
+		context empty.
+
+		This takes constant time. The memory resource of the context goes
+		with its contents, if it is owned by the context.
+	  */
+	void move_to(context& other) {
+		other.asset_map.swap(asset_map);
+		other.owned_mem.swap(owned_mem);
+		if(other.owned_mem) {
+			other.mem = other.owned_mem.get();
+			mem = nullptr;
+		}
+	}
+
+	/** Return the number of assets in the context */
+	inline size_t size() const { return asset_map.size(); }
+
+	/** Reserve room for at least `n` assets, allocating the slots at once */
+	inline void reserve(size_t n) { asset_map.reserve(n); }
+
+	/** Return the assets of the context */
+	inline const resource_map<asset>& assets() const { return asset_map; }
+
+	/**
+		Return the memory resource of the context.
+
+		Instances of the context can allocate from it, by injecting
+		`scope_memory()`. Unless set, it is the default memory resource.
+	  */
+	inline std::pmr::memory_resource* memory() const {
+		return mem ? mem : std::pmr::get_default_resource();
+	}
+
+	/** Return true if a memory resource is set for the context */
+	inline bool has_memory() const { return mem!=nullptr; }
+
+	/**
+		Set the memory resource of the context.
+
+		The memory resource must outlive the instances of the context.
+	  */
+	inline void set_memory(std::pmr::memory_resource* m) { mem = m; }
+
+	/**
+		Set a memory resource owned by the context.
+
+		The memory resource is destroyed when the context is cleared,
+		after its instances are disposed.
+	  */
+	inline void set_memory(std::unique_ptr<std::pmr::memory_resource> m) {
+		owned_mem = std::move(m);
+		mem = owned_mem.get();
+	}
+
+	context() = default;
+	context(const context&) = delete;
+	context& operator=(const context&) = delete;
+
 	/**
 		Dispose the contents and destroy the context.
 		*/
@@ -80,7 +185,261 @@ public:
 	}
 
 private:
+	typedef std::pair<const resourceid*, asset*> entry;
+
+	static contextual_base* manager_of(const resourceid& rid, const asset& ass) {
+		if(ass.manager()) return ass.manager();
+		try {
+			return providence().at(rid);
+		} catch(std::out_of_range) {
+			throw disposal_error(u::str_builder()
+				<<"Could not obtain resource manager for " << rid
+				<< " found in the context!");
+		}
+	}
+
+	// Order the assets so that dependents come before their dependencies
+	std::vector<entry> disposal_order()
+	{
+		std::vector<entry> ret;
+		ret.reserve(asset_map.size());
+		if(asset_map.size() < 2) {
+			for(auto& [rid, ass] : asset_map) ret.emplace_back(&rid, &ass);
+			return ret;
+		}
+
+		// depth-first search over the dependencies in the context,
+		// emitting each asset after its dependencies
+		std::unordered_map<const contextual_base*, entry> by_rm;
+		for(auto& [rid, ass] : asset_map)
+			if(ass.manager()) by_rm.emplace(ass.manager(), entry(&rid, &ass));
+
+		std::unordered_set<const asset*> visited;
+		std::vector<std::pair<entry, std::vector<const contextual_base*>>> stack;
+		auto push = [&](const entry& e) {
+			if(! visited.insert(e.second).second) return;
+			std::vector<const contextual_base*> deps;
+			if(const contextual_base* rm = e.second->manager()) {
+				auto add = [&](const injection_list& l) { deps.insert(deps.end(), l.begin(), l.end()); };
+				add(rm->provider_injections());
+				add(rm->init_injections());
+				add(rm->disposer_injections());
+				for(size_t i=0; i < rm->number_of_injectors(); ++i)
+					add(rm->injector_injections(i));
+			}
+			stack.emplace_back(e, std::move(deps));
+		};
+
+		for(auto& [rid, ass] : asset_map) {
+			push(entry(&rid, &ass));
+			while(! stack.empty()) {
+				auto& deps = stack.back().second;
+				if(deps.empty()) {
+					ret.push_back(stack.back().first);
+					stack.pop_back();
+					continue;
+				}
+				const contextual_base* dep = deps.back();
+				deps.pop_back();
+				auto iter = by_rm.find(dep);
+				if(iter!=by_rm.end()) push(iter->second);
+			}
+		}
+		std::reverse(ret.begin(), ret.end());
+		return ret;
+	}
+
+	// Dispose every asset in disposal order, each in its own try, and
+	// empty the context. Return the number of failures; the first one
+	// is stored in `first`, if given.
+	template <typename Dispose>
+	size_t dispose_each(Dispose&& dispose, std::exception_ptr* first = nullptr) {
+		size_t failures = 0;
+		for(auto& [rid, ass] : disposal_order())
+			try {
+				dispose(*rid, *ass);
+			} catch(...) {
+				if(failures++ == 0 && first) *first = std::current_exception();
+			}
+		release();
+		return failures;
+	}
+
+	void release() {
+		asset_map.clear();
+		if(owned_mem) {
+			owned_mem.reset();
+			mem = nullptr;
+		}
+	}
+
 	resource_map<asset> asset_map;
+	std::pmr::memory_resource* mem = nullptr;
+	std::unique_ptr<std::pmr::memory_resource> owned_mem;
+};
+
+
+/**
+	Disposes the contexts of deactivated scopes on a background thread.
+
+	By default, when a `LocalScope` or the last guard of a `GuardedScope` is
+	destroyed, its context is cleared on the same thread, running all the
+	disposers. When the reclaimer is enabled, the contents of the context
+	are instead moved (in constant time) to a queue, and a background thread
+	disposes them, in dependency order.
+
+	A context is still cleared synchronously if some instance in it must be
+	disposed synchronously (see `resource::dispose_synchronously()`), or if
+	its disposer has resource arguments. Observers are notified of the
+	disposals when the context is retired, rather than when the disposers run.
+	```
+	reclaimer::enable();
+	...
+	auto s = reclaimer::stats();   // queue length, lag
+	```
+	`container::clear()` waits for the queue to be drained.
+  */
+class reclaimer
+{
+public:
+	/// The clock of the reclamation lag
+	typedef std::chrono::steady_clock clock;
+
+	/// Counters of the reclaimer
+	struct statistics {
+		size_t queued = 0;        //< contexts waiting to be disposed
+		size_t reclaimed = 0;     //< contexts disposed in the background
+		size_t synchronous = 0;   //< contexts cleared synchronously, while enabled
+		size_t failures = 0;      //< disposers that threw in the background
+		clock::duration last_lag {};  //< time from retirement to disposal, last context
+		clock::duration max_lag {};   //< the maximum such time
+	};
+
+	/**
+		Enable or disable asynchronous disposal.
+
+		Disabling it does not drain the queue (see `drain()`).
+	  */
+	static void enable(bool on = true) {
+		state& s = st();
+		std::lock_guard<std::mutex> lock(s.mutex);
+		s.enabled.store(on, std::memory_order_relaxed);
+		if(on && ! s.worker.joinable())
+			s.worker = std::thread(work);
+	}
+
+	/** Return true if asynchronous disposal is enabled */
+	static inline bool enabled() {
+		return st().enabled.load(std::memory_order_relaxed);
+	}
+
+	/**
+		Dispose the contents of a context, now or in the background.
+	  */
+	static void retire(context& ctx)
+	{
+		if(ctx.size()==0) return;
+		state& s = st();
+		if(! enabled() || ctx.requires_sync_disposal()) {
+			if(enabled()) {
+				std::lock_guard<std::mutex> lock(s.mutex);
+				++ s.counters.synchronous;
+			}
+			ctx.clear();
+			return;
+		}
+
+		lifecycle_observers& obs = providence().observers();
+		if(obs.observing(Event::disposed)) {
+			for(auto& [rid, ass] : ctx.assets())
+				obs.notify(Event::disposed, ass.manager(), ass.manager()->scope_qual().type());
+			obs.flush();
+		}
+
+		auto retired = std::make_unique<context>();
+		ctx.move_to(*retired);
+		{
+			std::lock_guard<std::mutex> lock(s.mutex);
+			s.queue.push_back({ std::move(retired), clock::now() });
+			s.counters.queued = s.queue.size();
+		}
+		s.wakeup.notify_all();
+	}
+
+	/**
+		Wait until all retired contexts are disposed.
+	  */
+	static void drain() {
+		state& s = st();
+		std::unique_lock<std::mutex> lock(s.mutex);
+		s.idle.wait(lock, [&]() { return s.queue.empty() && ! s.busy; });
+	}
+
+	/** Return the counters of the reclaimer */
+	static statistics stats() {
+		state& s = st();
+		std::lock_guard<std::mutex> lock(s.mutex);
+		return s.counters;
+	}
+
+private:
+	struct item {
+		std::unique_ptr<context> ctx;
+		clock::time_point retired;
+	};
+
+	struct state {
+		std::mutex mutex;
+		std::condition_variable wakeup, idle;
+		std::deque<item> queue;      // guarded by mutex
+		statistics counters;         // guarded by mutex
+		bool busy = false;           // guarded by mutex
+		bool stopping = false;       // guarded by mutex
+		std::atomic<bool> enabled {false};
+		std::thread worker;
+
+		~state() {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			wakeup.notify_all();
+			if(worker.joinable()) worker.join();
+		}
+	};
+
+	static state& st() {
+		static state s;
+		return s;
+	}
+
+	static void work()
+	{
+		state& s = st();
+		std::unique_lock<std::mutex> lock(s.mutex);
+		while(true) {
+			s.wakeup.wait(lock, [&]() { return s.stopping || ! s.queue.empty(); });
+			if(s.queue.empty()) return;   // stopping, and drained
+
+			item it = std::move(s.queue.front());
+			s.queue.pop_front();
+			s.busy = true;
+			lock.unlock();
+
+			size_t failed = it.ctx->dispose_detached();
+			it.ctx.reset();
+			auto lag = clock::now() - it.retired;
+
+			lock.lock();
+			s.busy = false;
+			s.counters.queued = s.queue.size();
+			++ s.counters.reclaimed;
+			s.counters.failures += failed;
+			s.counters.last_lag = lag;
+			s.counters.max_lag = std::max(s.counters.max_lag, lag);
+			if(s.queue.empty()) s.idle.notify_all();
+		}
+	}
 };
 
 
@@ -91,18 +450,63 @@ private:
 //==================================
 
 
+namespace detail {
+	// true if a scope class defines a static memory()
+	template <typename ScopeClass, typename = std::void_t<>>
+	struct has_memory : std::false_type { };
+	template <typename ScopeClass>
+	struct has_memory<ScopeClass, std::void_t<decltype(ScopeClass::memory())>>
+		: std::true_type { };
+
+	/**
+		Report activation/deactivation of scope class `ScopeClass`
+		to the lifecycle observers (if any).
+	  */
+	template <typename ScopeClass>
+	inline void scope_event(Event e)
+	{
+		lifecycle_observers& obs = providence().observers();
+		if(obs.observing(e)) {
+			obs.notify(e, nullptr, typeid(ScopeClass));
+			if(e==Event::scope_deactivated) obs.flush();
+		}
+	}
+}
+
+
+namespace detail {
+	/**
+		A source of ready instances of a resource in `New` scope.
+		@see ready_queue
+	  */
+	struct ready_source
+	{
+		virtual ~ready_source() { }
+
+		/// Move a created instance into an asset; return false if there is none
+		virtual bool pop(asset& ass) = 0;
+
+		/// Stop making instances, and dispose the instances not taken
+		virtual void close() = 0;
+	};
+}
+
+
 /**
 	A scope that always returns new resource instances.
 
 	This scope is not associated with a context; every time
 	it is asked for an object, it accesses the resource manager
-	to provide a new value.
+	to provide a new value, unless the resource has a source of
+	ready instances (see `prefill()`).
 
 	It is not clear that this scope is useful in applications,
 	but it is quite useful in testing.
   */
 struct NewScope
 {
+	/// The scope qualifier `New` is a literal
+	typedef void static_id_tag;
 
 	static std::tuple<asset*, bool> get_asset(const resourceid& rid)
 	{
@@ -112,11 +516,257 @@ struct NewScope
 		// Possible: some sort of signalling the caller to "make a copy?"
 		static asset ass(std::any{});
 		ass = asset(std::any());
+		if(n_sources.load(std::memory_order_acquire) > 0)
+			if(auto src = ready_source_of(rid); src && src->pop(ass)) {
+				ass.set_phase(Phase::created);
+				return { (&ass), false };
+			}
 		return { (&ass) , true };
 	}
 
 	static void drop_asset(const resourceid& rid)
 	{ }
+
+	/**
+		Set the source of ready instances of a resource.
+
+		A previous source of the resource is closed. A null `src` removes
+		the source.
+	  */
+	static void set_ready_source(const resourceid& rid,
+		std::shared_ptr<detail::ready_source> src)
+	{
+		std::shared_ptr<detail::ready_source> old;
+		{
+			std::lock_guard<std::shared_mutex> lock(sources_mutex);
+			auto iter = sources.find(rid);
+			if(iter!=sources.end()) {
+				old = std::move(iter->second);
+				sources.erase(iter);
+			}
+			if(src) sources.emplace(rid, std::move(src));
+			n_sources.store(sources.size(), std::memory_order_release);
+		}
+		if(old) old->close();
+	}
+
+	/**
+		Close and remove all sources of ready instances.
+	  */
+	static void clear_ready_sources()
+	{
+		resource_map<std::shared_ptr<detail::ready_source>> old;
+		{
+			std::lock_guard<std::shared_mutex> lock(sources_mutex);
+			old.swap(sources);
+			n_sources.store(0, std::memory_order_release);
+		}
+		for(auto& [rid, src] : old)
+			src->close();
+	}
+
+private:
+	static std::shared_ptr<detail::ready_source> ready_source_of(const resourceid& rid)
+	{
+		std::shared_lock<std::shared_mutex> lock(sources_mutex);
+		auto iter = sources.find(rid);
+		return iter==sources.end() ? nullptr : iter->second;
+	}
+
+	static inline std::shared_mutex sources_mutex;
+	static inline resource_map<std::shared_ptr<detail::ready_source>> sources;
+	static inline std::atomic<size_t> n_sources {0};
+};
+
+
+inline bool detail::is_transient(const contextual_base* rm)
+{
+	return rm->scope_qual().type_id()==u::type_id_of<NewScope>();
+}
+
+
+/**
+	A set of resources instantiated eagerly when a scope is activated.
+
+	Members are instantiated in one pass, in dependency order; the order
+	is computed on the first activation, and again after the set or the
+	container changes. The slots of the members in the context are
+	allocated at once. If parallel resolution is enabled (see
+	`container::set_parallel()`), independent members are provided
+	concurrently.
+
+	The scopes which support eager sets (`GuardedScope` and `LocalScope`)
+	keep one per scope class:
+	```
+	TxScope::eager_resources().add(connection, cursor);
+	```
+	Members that are re-provided after an activation are still instantiated,
+	maybe in a stale order; this only affects the batching.
+
+	The set may also hold guesses, which are instantiated speculatively
+	after the members (see `set_speculative()` and `speculation`).
+  */
+class eager_set
+{
+public:
+	/// Counters of speculative instantiation
+	struct statistics {
+		size_t speculated = 0;  //< instances made speculatively
+		size_t failed = 0;      //< speculative instantiations that threw
+	};
+
+	/**
+		Add resources to the set.
+		@param rs resources in the scope that holds the set
+	  */
+	template <typename... Resources>
+	void add(const Resources&... rs) {
+		(members.push_back(resourceid(rs)), ...);
+		planned = false;
+	}
+
+	/** Return the number of members */
+	inline size_t size() const { return members.size(); }
+
+	/** Remove all members and guesses */
+	void clear() {
+		members.clear();
+		guesses.clear();
+		planned = false;
+	}
+
+	/**
+		Set the resources instantiated speculatively on activation.
+
+		@param rids the guesses, most likely first
+
+		Guesses are made after the members, with `container::speculate()`.
+		Only guesses which are pure, and depend only on pure resources,
+		are made (see `resource::pure()`); failures are ignored.
+	  */
+	void set_speculative(std::vector<resourceid> rids) {
+		guesses = std::move(rids);
+		planned = false;
+	}
+
+	/** Return the resources instantiated speculatively */
+	inline const std::vector<resourceid>& speculative() const { return guesses; }
+
+	/** Return the counters of speculative instantiation */
+	inline statistics stats() const { return counters; }
+
+	/**
+		Instantiate the members into a context.
+
+		@param ctx the context of the scope being activated, which must be
+		       the active context of the scope
+		@throws instantiation_error if a member cannot be instantiated
+
+		Undeclared members are skipped.
+	  */
+	void materialize(context& ctx)
+	{
+		if(members.empty() && guesses.empty()) return;
+		container& p = providence();
+		if(! planned || plan_epoch!=p.epoch() || plan_declared!=p.declared())
+			make_plan(p);
+		ctx.reserve(ctx.size() + plan.size() + spec_plan.size());
+		p.instantiate_all(plan);
+		if(! spec_plan.empty()) {
+			auto [made, failed] = p.speculate(spec_plan);
+			counters.speculated += made;
+			counters.failed += failed;
+		}
+	}
+
+private:
+	void make_plan(container& p)
+	{
+		std::unordered_set<contextual_base*> taken;
+		order(p, members, taken, plan);
+		std::unordered_map<contextual_base*, bool> purity;
+		order(p, guesses, taken, spec_plan, [&](contextual_base* rm) {
+			return pure(rm, purity);
+		});
+		plan_epoch = p.epoch();
+		plan_declared = p.declared();
+		planned = true;
+	}
+
+	// Order the declared resources of rids, not yet taken, so that
+	// dependencies come first
+	template <typename Pred = std::nullptr_t>
+	static void order(container& p, const std::vector<resourceid>& rids,
+		std::unordered_set<contextual_base*>& taken,
+		std::vector<contextual_base*>& out, Pred pred = nullptr)
+	{
+		std::unordered_set<contextual_base*> wanted, visited;
+		std::vector<contextual_base*> roots;
+		for(auto& rid : rids) {
+			contextual_base* rm;
+			try {
+				rm = p.at(rid);
+			} catch(std::out_of_range&) {
+				continue;
+			}
+			if constexpr(! std::is_null_pointer_v<Pred>)
+				if(! pred(rm)) continue;
+			if(! taken.count(rm) && wanted.insert(rm).second) roots.push_back(rm);
+		}
+
+		// depth-first, through the other resources as well
+		out.clear();
+		std::vector<std::pair<contextual_base*, bool>> stack;
+		for(auto root : roots) {
+			stack.push_back({root, false});
+			while(! stack.empty()) {
+				auto [rm, expanded] = stack.back();
+				stack.pop_back();
+				if(expanded) {
+					if(wanted.count(rm)) {
+						out.push_back(rm);
+						taken.insert(rm);
+					}
+					continue;
+				}
+				if(! visited.insert(rm).second) continue;
+				stack.push_back({rm, true});
+				for_each_dependency(rm, [&](contextual_base* d) {
+					if(! visited.count(d)) stack.push_back({d, false});
+				});
+			}
+		}
+	}
+
+	// Return true if rm and its dependencies are pure
+	static bool pure(contextual_base* rm, std::unordered_map<contextual_base*, bool>& memo)
+	{
+		auto [iter, isnew] = memo.try_emplace(rm, false);  // false on cycles
+		if(! isnew) return iter->second;
+		bool ok = rm->is_pure();
+		if(ok)
+			for_each_dependency(rm, [&](contextual_base* d) {
+				ok = ok && pure(d, memo);
+			});
+		memo[rm] = ok;
+		return ok;
+	}
+
+	template <typename Func>
+	static void for_each_dependency(contextual_base* rm, Func func)
+	{
+		for(auto d : rm->provider_injections()) func(d);
+		for(size_t i=0; i < rm->number_of_injectors(); ++i)
+			for(auto d : rm->injector_injections(i)) func(d);
+		for(auto d : rm->init_injections()) func(d);
+	}
+
+	std::vector<resourceid> members, guesses;
+	std::vector<contextual_base*> plan, spec_plan;
+	statistics counters;
+	size_t plan_epoch = 0;
+	size_t plan_declared = 0;
+	bool planned = false;
 };
 
 
@@ -147,8 +797,13 @@ struct GuardedScope
 {
 	/**
 		Constructor, increases the turnstile count.
+
+		When the scope is activated, the members of `eager_resources()`
+		are instantiated.
+		@throws instantiation_error if an eager resource cannot be
+		        instantiated; the scope is then left inactive
 	  */
-	inline GuardedScope() noexcept {  ++_n; }
+	inline GuardedScope() { enter(); }
 
 	/**
 		Destructor, decreases the turnstile count.
@@ -157,12 +812,13 @@ struct GuardedScope
 		-- _n;
 		if(_n==0)
 			try {
-				ctx.clear();
+				reclaimer::retire(ctx);
+				detail::scope_event<Tag>(Event::scope_deactivated);
 			} catch(...) { }
 	}
 
-	inline GuardedScope(const GuardedScope<Tag>&) noexcept { ++_n; }
-	inline GuardedScope& operator=(const GuardedScope<Tag>&) noexcept { ++_n; };
+	inline GuardedScope(const GuardedScope<Tag>&) noexcept { enter(); }
+	inline GuardedScope& operator=(const GuardedScope<Tag>&) noexcept { enter(); };
 
 	/** Move operators (have no effect) */
 	inline GuardedScope(GuardedScope&& _other) noexcept { }
@@ -192,9 +848,33 @@ struct GuardedScope
 		Returns the current turnstile count.
 	  */
 	static inline size_t count() { return _n; }
+
+	/**
+		Return the resources instantiated when the scope is activated.
+	  */
+	static inline eager_set& eager_resources() { return eager; }
 private:
+	static inline void enter() {
+		if(++_n==1) {
+			try {
+				detail::scope_event<Tag>(Event::scope_activated);
+			} catch(...) { }
+			try {
+				eager.materialize(ctx);
+			} catch(...) {
+				-- _n;
+				try {
+					ctx.clear();
+					detail::scope_event<Tag>(Event::scope_deactivated);
+				} catch(...) { }
+				throw;
+			}
+		}
+	}
+
 	static inline size_t _n=0;
 	static inline context ctx;
+	static inline eager_set eager;
 };
 
 
@@ -215,19 +895,46 @@ private:
 	have nested lifetimes. This can be ensured by only creating them
 	as local variables on the stack, which is the indended use.
 
+	Each context has an arena, a monotonic memory resource created on first
+	use (see `scope_memory()`), which is released at once when the context
+	is cleared. The memory of the arenas is recycled across activations.
+	When the context is disposed in the background (see `reclaimer`), its
+	arena goes with it.
+
 	This class is neither copyable nor movable.
   */
 template <typename Tag>
 class LocalScope
 {
 public:
+	/**
+		Push a new context, and instantiate the members of
+		`eager_resources()` into it.
+		@throws instantiation_error if an eager resource cannot be
+		        instantiated; the context is then popped
+	  */
 	LocalScope() {
 		saved_ctx = current_ctx;
 		current_ctx = &ctx;
+		detail::scope_event<Tag>(Event::scope_activated);
+		try {
+			eager.materialize(ctx);
+		} catch(...) {
+			try {
+				ctx.clear();
+				detail::scope_event<Tag>(Event::scope_deactivated);
+			} catch(...) { }
+			current_ctx = saved_ctx;
+			throw;
+		}
 	}
 	~LocalScope()
 	{
 		assert(current_ctx == &ctx);
+		try {
+			reclaimer::retire(ctx);
+			detail::scope_event<Tag>(Event::scope_deactivated);
+		} catch(...) { }
 		current_ctx = saved_ctx;
 	}
 
@@ -250,10 +957,38 @@ public:
 	  */
 	static inline bool is_active() { return current_ctx!=nullptr; }
 
+	/**
+		Return the arena of the active context.
+		@throws inactive_scope_error if the scope is inactive
+	  */
+	static inline std::pmr::memory_resource* memory()
+	{
+		if(! is_active()) throw inactive_scope_error(u::str_builder()
+			<< "Trying to get the memory of "
+			<< u::demangle(typeid(Tag).name()) << " while scope is inactive");
+		if(! current_ctx->has_memory())
+			current_ctx->set_memory(
+				std::make_unique<std::pmr::monotonic_buffer_resource>(&recycled()));
+		return current_ctx->memory();
+	}
+
+	/**
+		Return the resources instantiated when a context is pushed.
+	  */
+	static inline eager_set& eager_resources() { return eager; }
+
 private:
+	// the upstream of the arenas, which keeps the memory they release;
+	// arenas may be released by the reclaimer thread
+	static std::pmr::synchronized_pool_resource& recycled() {
+		static std::pmr::synchronized_pool_resource pool;
+		return pool;
+	}
+
 	context ctx;
 	context* saved_ctx;
 	inline static context* current_ctx; // zero-initialized
+	inline static eager_set eager;
 };
 
 
@@ -269,6 +1004,8 @@ private:
   */
 class GlobalScope {
 public:
+	/// The scope qualifier `Global` is a literal
+	typedef void static_id_tag;
 
 	static inline std::tuple<asset*, bool> get_asset(const resourceid& rid)
 	{
@@ -294,14 +1031,344 @@ private:
 
 
 inline void container::clear() {
+	// ready instances may depend on global instances
+	NewScope::clear_ready_sources();
+	for(auto& hook : clear_hooks)
+		hook();
+	reclaimer::drain();
 	GlobalScope::clear();
 
-	// Delete all resource managers
+	// Delete all resource managers (aliases share them)
 	for(auto& [rid  ,rm] : rms) {
-		(void) rid;//maybe unused?
-		delete rm;
+		if(! is_alias(rid))
+			delete rm;
 	}
 	rms.clear();
+	alias_ids.clear();
+	decl_log.clear();
+	lazy.clear();
+	n_modules = 0;
+	++n_cleared;
+	n_declared.store(0, std::memory_order_relaxed);
+
+	// Drop all observers
+	events.clear();
+
+	// Stop parallel resolution
+	pool.reset();
+
+	detail::preforked = false;
+}
+
+
+template <typename Resource>
+resource_manager<Resource>* container::transient_manager(const Resource& r)
+{
+	resource_manager<Resource>* rm = get_declared(r);
+	if(rm==nullptr)
+		throw instantiation_error(u::str_builder()
+			<< "Undeclared resource in instantiating " << resourceid(r));
+	if(rm->scope_qual().type_id()!=u::type_id_of<NewScope>())
+		throw instantiation_error(u::str_builder()
+			<< "Bulk instantiation of " << resourceid(r)
+			<< ", which is not in New scope");
+	return rm;
+}
+
+template <typename Resource, typename OutputIterator>
+OutputIterator container::make_n(const Resource& r, size_t n, OutputIterator out)
+{
+	resource_manager<Resource>* rm = transient_manager(r);
+	bool observed = events.observing();
+	bool timed = observed && events.timing();
+	std::chrono::steady_clock::time_point start;
+	auto elapsed = [&]() {
+		return timed ? std::chrono::steady_clock::now() - start
+			: std::chrono::nanoseconds{};
+	};
+	try {
+		auto lifecycle = rm->prebind();
+		for(size_t i=0; i<n; ++i) {
+			if(timed) start = std::chrono::steady_clock::now();
+			try {
+				*out = lifecycle->create();
+			} catch(...) {
+				if(observed) notify(Event::failed, rm, elapsed());
+				throw;
+			}
+			++out;
+			if(observed) {
+				// the whole lifecycle is timed, as the provider is not run alone
+				notify(Event::provided, rm, elapsed());
+				notify(Event::created, rm);
+			}
+		}
+	} catch(...) {
+		if(observed) events.flush();
+		std::throw_with_nested(instantiation_error(u::str_builder()
+			<< "Error while instantiating " << resourceid(r)));
+	}
+	if(observed) events.flush();
+	return out;
+}
+
+template <typename Resource, typename Output>
+auto container::get_n(const Resource& r, size_t n, Output&& out)
+{
+	typedef std::vector<typename Resource::instance_type> pool_type;
+	if constexpr (std::is_same_v<std::decay_t<Output>, pool_type>) {
+		pool_type& into = out;
+		const size_t start = into.size();
+		into.reserve(start + n);
+		try {
+			make_n(r, n, std::back_inserter(into));
+		} catch(...) {
+			try {
+				dispose_n(r, into.begin()+start, into.end());
+			} catch(...) { }
+			into.erase(into.begin()+start, into.end());
+			throw;
+		}
+	} else
+		return make_n(r, n, out);
+}
+
+template <typename Resource, typename Iterator>
+void container::dispose_n(const Resource& r, Iterator first, Iterator last)
+{
+	resource_manager<Resource>* rm = transient_manager(r);
+	auto disposer = rm->prebind_disposer();
+	if(! disposer) return;
+	bool observed = events.observing(Event::disposed);
+	for(; first!=last; ++first) {
+		disposer(*first);
+		if(observed) events.notify(Event::disposed, rm, typeid(NewScope));
+	}
+	if(observed) events.flush();
+}
+
+
+inline void container::resolve_chain(contextual_base* rm)
+{
+	// A frame is a resource whose provider dependencies are being walked
+	struct frame {
+		contextual_base* rm;
+		asset* ass;
+		size_t next;  // next dependency to visit
+	};
+	std::vector<frame> work { {rm, nullptr, 0} };
+
+	while(true) {
+		frame& top = work.back();
+		const injection_list& deps = top.rm->provider_injections();
+		if(top.next < deps.size()) {
+			contextual_base* dep = deps[top.next++];
+			if(dep->scope_qual().type_id()==u::type_id_of<NewScope>())
+				continue;
+
+			asset* ass;
+			bool isnew;
+			try {
+				std::tie(ass, isnew) = dep->scope().get(dep->rid());
+			} catch(inactive_scope_error&) {
+				continue; // let the provider report it
+			}
+			// existing assets are provided, or in a cycle the provider will report
+			if(isnew)
+				work.push_back({dep, ass, 0});
+			continue;
+		}
+
+		// all dependencies of the top are provided
+		if(work.size()==1)
+			return;
+		try {
+			provide_asset(top.rm, top.ass);
+		} catch(...) {
+			std::exception_ptr error = std::current_exception();
+
+			// the assets on the stack were allocated, but will not be provided
+			for(size_t i = work.size()-1; i>0; --i)
+				work[i].rm->scope().drop(work[i].rm->rid());
+
+			// report like a recursive instantiation, eliding the middle of long chains
+			for(size_t i = work.size()-1; i>0; --i) {
+				if(work.size()-1-i == max_error_nesting && i>1) {
+					error = nest_error(error, u::str_builder()
+						<< "Error while instantiating " << i-1
+						<< " more resources in a dependency chain");
+					i = 1;
+				}
+				error = nest_error(error, u::str_builder()
+					<< "Error while instantiating " << work[i].rm->rid());
+			}
+			std::rethrow_exception(error);
+		}
+		defer_creation(top.ass, top.rm);
+		work.pop_back();
+	}
+}
+
+
+inline void container::prefetch(contextual_base* rm, prefetch_guard& guard)
+{
+	std::unordered_set<contextual_base*> seen { rm };
+	std::vector<contextual_base*> todo;
+	for(auto d : rm->provider_injections())
+		if(seen.insert(d).second) todo.push_back(d);
+	for(size_t i=0; i < rm->number_of_injectors(); ++i)
+		for(auto d : rm->injector_injections(i))
+			if(seen.insert(d).second) todo.push_back(d);
+	prefetch_from(todo, seen, guard);
+}
+
+
+inline void container::instantiate_all(const std::vector<contextual_base*>& set)
+{
+	prefetch_guard prefetched(*this);
+	if(pool && set.size() > 1) {
+		std::unordered_set<contextual_base*> seen(set.begin(), set.end());
+		std::vector<contextual_base*> todo(set.rbegin(), set.rend());
+		prefetch_from(todo, seen, prefetched);
+	}
+	for(contextual_base* rm : set)
+		get_any(rm->rid(), Phase::created);
+}
+
+
+inline std::pair<size_t, size_t> container::speculate(const std::vector<contextual_base*>& set)
+{
+	// skip the instances that exist, and those that cannot be made here
+	std::vector<contextual_base*> fresh;
+	for(contextual_base* rm : set) {
+		try {
+			auto [ass, isnew] = rm->scope().get(rm->rid());
+			if(! isnew) continue;
+			rm->scope().drop(rm->rid());
+		} catch(inactive_scope_error&) {
+			continue;
+		}
+		fresh.push_back(rm);
+	}
+	if(fresh.empty()) return { 0, 0 };
+
+	if(events.observing()) events.flush();
+	size_t made = 0, failed = 0;
+	in_speculation = true;
+	try {
+		prefetch_guard prefetched(*this);
+		if(pool && fresh.size() > 1) {
+			std::unordered_set<contextual_base*> seen(fresh.begin(), fresh.end());
+			std::vector<contextual_base*> todo(fresh.rbegin(), fresh.rend());
+			prefetch_from(todo, seen, prefetched);
+		}
+		for(contextual_base* rm : fresh) {
+			try {
+				get_any(rm->rid(), Phase::created);
+			} catch(instantiation_error&) {
+				++ failed;
+				continue;
+			}
+			asset* ass = std::get<0>(rm->scope().get(rm->rid()));
+			ass->set_speculative(true);
+			++ made;
+		}
+		if(events.observing()) events.flush();
+	} catch(...) {
+		in_speculation = false;
+		throw;
+	}
+	in_speculation = false;
+	return { made, failed };
+}
+
+
+inline void container::prefetch_from(std::vector<contextual_base*>& todo,
+	std::unordered_set<contextual_base*>& seen, prefetch_guard& guard)
+{
+	struct job {
+		contextual_base* rm;
+		asset* ass;
+		std::exception_ptr error;
+		std::chrono::nanoseconds elapsed {};
+	};
+	std::vector<job> jobs;
+
+	// Walk the dependencies that do not exist yet, collecting the leaves
+	auto add = [&](const injection_list& deps) {
+		for(auto d : deps)
+			if(seen.insert(d).second) todo.push_back(d);
+	};
+	auto add_deps = [&](contextual_base* m) {
+		add(m->provider_injections());
+		for(size_t i=0; i < m->number_of_injectors(); ++i)
+			add(m->injector_injections(i));
+	};
+
+	while(! todo.empty()) {
+		contextual_base* dep = todo.back();
+		todo.pop_back();
+
+		// new instances are made at each injection, look through them
+		if(dep->scope_qual().type_id()==u::type_id_of<NewScope>()) {
+			add_deps(dep);
+			continue;
+		}
+
+		asset* ass;
+		bool isnew;
+		try {
+			std::tie(ass, isnew) = dep->scope().get(dep->rid());
+		} catch(inactive_scope_error&) {
+			continue; // let the usual resolution report it
+		}
+		if(! isnew) continue;  // already provided, or being provided
+
+		if(dep->has_provider() && dep->provider_injections().empty())
+			jobs.push_back({dep, ass});
+		else {
+			dep->scope().drop(dep->rid());
+			add_deps(dep);
+		}
+	}
+
+	if(jobs.size()<2) {
+		// nothing to gain
+		for(auto& j : jobs) j.rm->scope().drop(j.rm->rid());
+		return;
+	}
+
+	bool timed = events.timing();
+	{
+		task_group group(*pool);
+		for(auto& j : jobs)
+			group.run([&j, timed]() {
+				auto start = timed ? std::chrono::steady_clock::now()
+					: std::chrono::steady_clock::time_point{};
+				try {
+					j.rm->provide(j.ass->object());
+				} catch(...) {
+					j.error = std::current_exception();
+				}
+				if(timed) j.elapsed = std::chrono::steady_clock::now() - start;
+			});
+		group.wait();
+	}
+
+	for(auto& j : jobs) {
+		if(j.error) {
+			// reported by the usual resolution
+			j.rm->scope().drop(j.rm->rid());
+			notify(Event::failed, j.rm, j.elapsed);
+			prefetch_errors[j.rm] = j.error;
+			guard.failed.push_back(j.rm);
+			continue;
+		}
+		j.ass->set_phase(Phase::provided);
+		j.ass->set_manager(j.rm);
+		notify(Event::provided, j.rm, j.elapsed);
+		defer_creation(j.ass, j.rm);
+	}
 }
 
 
@@ -345,14 +1412,57 @@ struct scope_proxy : scope_api, detail::qual_impl<ScopeClass>
 		ScopeClass::drop_asset(rid);
 	}
 
+	std::pmr::memory_resource* memory() const override {
+		if constexpr (detail::has_memory<ScopeClass>::value)
+			return ScopeClass::memory();
+		else
+			return scope_api::memory();
+	}
+
 	virtual string name() const override {
 		return u::demangle(typeid(ScopeClass).name());
 	}
 };
 
 
-inline const qualifier New { std::make_shared<scope_proxy<NewScope>>() };
-inline const qualifier Global { std::make_shared<scope_proxy<GlobalScope>>() };
+inline const qualifier New { detail::qual_literal< scope_proxy<NewScope> > };
+inline const qualifier Global { detail::qual_literal< scope_proxy<GlobalScope> > };
+
+
+/// Qualifies the memory resources returned by `scope_memory()`
+DEFINE_VOID_QUALIFIER(ScopeMemory)
+
+/**
+	Return a resource whose instance is the memory resource of a scope.
+
+	@param scope a scope qualifier
+	@return a resource of type `resource<std::pmr::memory_resource*>`, with
+	        qualifiers `{scope, ScopeMemory}`
+	@throws config_error if `scope` is not a scope qualifier
+
+	The resource is declared on the first call. Injecting it into the
+	lifecycle calls of resources in the same scope, lets them allocate the
+	internals of their instances in the context (see `context::memory()`):
+	```
+	struct TempScope : LocalScope<TempScope> { };
+	qualifier Temp { new scope_proxy<TempScope> };
+
+	resource<std::pmr::string> body({Temp});
+	body.provide([](std::pmr::memory_resource* m) {
+		return std::pmr::string(read_body(), m);
+	}, scope_memory(Temp));
+	```
+  */
+inline resource<std::pmr::memory_resource*> scope_memory(const qualifier& scope)
+{
+	auto api = scope.get<scope_api>();
+	if(! api)
+		throw config_error(u::str_builder() << scope << " is not a scope qualifier");
+	resource<std::pmr::memory_resource*> r({scope, ScopeMemory});
+	if(providence().get_declared(r)==nullptr)
+		r.provide([api]() { return api->memory(); });
+	return r;
+}
 
 
 inline qualifier scope_spec(const qualifiers& qset)
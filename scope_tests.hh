@@ -4,6 +4,7 @@
 
 #include <cxxtest/TestSuite.h>
 #include <vector>
+#include <thread>
 
 #include "cdi.hh"
 
@@ -19,6 +20,8 @@ using namespace cdi;
 qualifier GlobalS { new scope_proxy<GlobalScope> };
 qualifier NewS { new scope_proxy<NewScope> };
 
+DEFINE_QUALIFIER(Layer, int, int)
+
 class ScopeTestSuite : public CxxTest::TestSuite
 {
 public:
@@ -32,6 +35,9 @@ public:
 
 		TS_ASSERT_EQUALS(GlobalS, qualifier(new scope_proxy<GlobalScope>));
 		TS_ASSERT_DIFFERS(NewS, qualifier(new scope_proxy<GlobalScope>));
+		TS_ASSERT_EQUALS(GlobalS, Global);
+		TS_ASSERT_EQUALS(NewS, New);
+		TS_ASSERT_EQUALS(New.get<scope_api>().use_count(), 0);
 
 		qualifiers Q { GlobalS, NewS };
 		TS_ASSERT_EQUALS(Q.size(),2);
@@ -267,4 +273,212 @@ public:
 		}
 	}
 
+	void test_disposal_order()
+	{
+		vector<string> disposed;
+		resource<string> a({Temp, Layer(1)}), b({Temp, Layer(2)}), c({Temp, Layer(3)});
+		a.provide([]() { return string("a"); })
+		 .dispose([&](string& x) { disposed.push_back(x); });
+		b.provide([](const string& x) { return x+"b"; }, a)
+		 .dispose([&](string& x) { disposed.push_back(x); });
+		c.provide([]() { return string("c"); })
+		 .inject([](string& x, const string& y) { x += y; }, b)
+		 .dispose([&](string& x) { disposed.push_back(x); });
+		{
+			TempScope s;
+			a.get();
+			c.get();
+		}
+		vector<string> expected {"cab", "ab", "a"};
+		TS_ASSERT_EQUALS(disposed, expected);
+	}
+
+	void test_throwing_disposer()
+	{
+		int na = 0, nb = 0;
+		resource<int> a({Temp, Layer(1)}), b({Temp, Layer(2)});
+		a.provide([]() { return 1; })
+		 .dispose([&](int&) { ++na; throw std::runtime_error("a"); });
+		b.provide([]() { return 2; })
+		 .dispose([&](int&) { ++nb; });
+		{
+			TempScope s;
+			a.get();
+			b.get();
+		}
+		// every instance is disposed once, though a disposer threw
+		TS_ASSERT_EQUALS(na, 1);
+		TS_ASSERT_EQUALS(nb, 1);
+	}
+
+	void test_async_disposal()
+	{
+		atomic<int> in_background {0}, inline_disposals {0};
+		auto main_thread = this_thread::get_id();
+		auto count = [&, main_thread](auto&) {
+			if(this_thread::get_id()==main_thread) ++inline_disposals;
+			else ++in_background;
+		};
+		resource<int> a({Temp}), s({Temp, Default});
+		a.provide([]() { return 1; }).dispose(count);
+		s.provide([]() { return 2; }).dispose(count).dispose_synchronously();
+
+		reclaimer::enable();
+		TS_ASSERT(reclaimer::enabled());
+		{
+			TempScope scope;
+			a.get();
+		}
+		reclaimer::drain();
+		TS_ASSERT_EQUALS(in_background, 1);
+		TS_ASSERT_EQUALS(inline_disposals, 0);
+		TS_ASSERT_EQUALS(reclaimer::stats().queued, 0);
+		TS_ASSERT_LESS_THAN_EQUALS(1, reclaimer::stats().reclaimed);
+
+		// a context with an instance to be disposed synchronously
+		size_t sync = reclaimer::stats().synchronous;
+		{
+			TempScope scope;
+			a.get();
+			s.get();
+		}
+		TS_ASSERT_EQUALS(inline_disposals, 2);
+		TS_ASSERT_EQUALS(reclaimer::stats().synchronous, sync+1);
+
+		// the arena goes with the context
+		resource<std::pmr::string> text({Temp});
+		text.provide([](std::pmr::memory_resource* m) {
+			return std::pmr::string(200, 'x', m);
+		}, scope_memory(Temp)).dispose([&](std::pmr::string& t) {
+			if(t.size()==200 && t.back()=='x') ++in_background;
+		});
+		{
+			TempScope scope;
+			text.get();
+		}
+		reclaimer::drain();
+		TS_ASSERT_EQUALS(in_background, 2);
+		reclaimer::enable(false);
+	}
+
+	void test_async_throwing_disposer()
+	{
+		atomic<int> na {0}, nb {0};
+		resource<int> a({Temp, Layer(1)}), b({Temp, Layer(2)});
+		a.provide([]() { return 1; })
+		 .dispose([&](int&) { ++na; throw std::runtime_error("a"); });
+		b.provide([]() { return 2; })
+		 .dispose([&](int&) { ++nb; });
+
+		reclaimer::enable();
+		size_t failures = reclaimer::stats().failures;
+		{
+			TempScope s;
+			a.get();
+			b.get();
+		}
+		reclaimer::drain();
+		TS_ASSERT_EQUALS(na, 1);
+		TS_ASSERT_EQUALS(nb, 1);
+		TS_ASSERT_EQUALS(reclaimer::stats().failures, failures+1);
+
+		// a context cleared synchronously
+		a.dispose_synchronously();
+		{
+			TempScope s;
+			a.get();
+			b.get();
+		}
+		TS_ASSERT_EQUALS(na, 2);
+		TS_ASSERT_EQUALS(nb, 2);
+		reclaimer::enable(false);
+	}
+
+	struct EagerScope : LocalScope<EagerScope> { };
+	static inline qualifier Eager { new scope_proxy<EagerScope> };
+	struct TxScope : GuardedScope<TxScope> { };
+	static inline qualifier Tx { new scope_proxy<TxScope> };
+
+	void test_eager_resources()
+	{
+		vector<string> made;
+		int disposed = 0;
+		resource<string> a({Eager, Layer(1)}), b({Eager, Layer(2)}), c({Eager, Layer(3)});
+		a.provide([&]() { made.push_back("a"); return string("a"); })
+		 .dispose([&](string&) { ++disposed; });
+		b.provide([&](const string& x) { made.push_back("b"); return x+"b"; }, a);
+		c.provide([&]() { made.push_back("c"); return string("c"); })
+		 .inject([](string& x, const string& y) { x += y; }, b);
+
+		EagerScope::eager_resources().add(c, b, a);
+		TS_ASSERT_EQUALS(EagerScope::eager_resources().size(), 3);
+		vector<string> expected {"a", "b", "c"};
+		{
+			EagerScope s;
+			TS_ASSERT_EQUALS(made, expected);
+			TS_ASSERT_EQUALS(c.get(), "cab");
+			TS_ASSERT_EQUALS(made.size(), 3);
+			{
+				EagerScope s2;
+				TS_ASSERT_EQUALS(made.size(), 6);
+			}
+		}
+		reclaimer::drain();
+		TS_ASSERT_EQUALS(disposed, 2);
+
+		// a failed activation disposes the instances made, and pops the context
+		resource<int> d({Eager});
+		d.provide([]() -> int { throw runtime_error("down"); });
+		EagerScope::eager_resources().add(d);
+		TS_ASSERT_THROWS(EagerScope(), instantiation_error);
+		TS_ASSERT(! EagerScope::is_active());
+		TS_ASSERT_EQUALS(disposed, 3);
+		EagerScope::eager_resources().clear();
+
+		// independent members are provided in parallel
+		atomic<int> opened {0};
+		resource<int> conn({Tx, Layer(1)}), cache({Tx, Layer(2)});
+		conn.provide([&]() { return ++opened; });
+		cache.provide([&]() { return ++opened; });
+		TxScope::eager_resources().add(conn, cache);
+		providence().set_parallel(2);
+		{
+			TxScope t1, t2;
+			TS_ASSERT_EQUALS(opened, 2);
+			int x = conn.get();
+			TS_ASSERT_EQUALS(x + cache.get(), 3);
+		}
+		providence().set_parallel(0);
+		TxScope::eager_resources().clear();
+	}
+
+	void test_scope_memory()
+	{
+		auto mem = scope_memory(Temp);
+		resource<std::pmr::vector<int>> v({Temp});
+		v.provide([](std::pmr::memory_resource* m) {
+			return std::pmr::vector<int>(100, 7, m);
+		}, mem);
+
+		TS_ASSERT_THROWS(TempScope::memory(), inactive_scope_error);
+		TS_ASSERT_EQUALS(Global.get<scope_api>()->memory(), std::pmr::get_default_resource());
+		TS_ASSERT_THROWS(scope_memory(Default), config_error);
+
+		{
+			TempScope s1;
+			auto m1 = mem.get();
+			TS_ASSERT_EQUALS(m1, TempScope::memory());
+			TS_ASSERT_EQUALS(m1, Temp.get<scope_api>()->memory());
+			TS_ASSERT_DIFFERS(m1, std::pmr::get_default_resource());
+			TS_ASSERT_EQUALS(v.get().get_allocator().resource(), m1);
+			TS_ASSERT_EQUALS(v.get()[99], 7);
+			const int* outer = v.get().data();
+			{
+				TempScope s2;
+				TS_ASSERT_DIFFERS(mem.get(), m1);
+				TS_ASSERT_DIFFERS(v.get().data(), outer);
+			}
+		}
+	}
+
 };
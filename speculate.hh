@@ -0,0 +1,250 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+
+#include "scope.hh"
+
+//=================================
+//
+//  speculative instantiation
+//
+//=================================
+
+namespace cdi {
+
+
+/**
+	Speculative instantiation of the resources of a scope, learned from
+	recorded access patterns.
+
+	@tparam Scope a scope class with an eager set, i.e., a `GuardedScope`
+	        or `LocalScope`
+
+	Once enabled, the order in which resources of the scope are first got
+	after each activation is recorded, through the lifecycle observers of
+	the container. The resources that are usually got are then instantiated
+	speculatively right after each activation, most likely first, as the
+	guesses of the scope's eager set (see `eager_set::set_speculative()`).
+	When parallel resolution is enabled (see `container::set_parallel()`),
+	independent guesses are provided on the worker threads.
+
+	Only resources declared side-effect free are made speculatively (see
+	`resource::pure()`), since the instances are thrown away when they
+	turn out not to be needed.
+	```
+	query_plan.provide(plan, schema).pure();
+	speculation<RequestScope>::enable(4);
+	...
+	auto s = speculation<RequestScope>::stats();
+	if(s.wasted > s.claimed) speculation<RequestScope>::enable(2, 0.8);
+	```
+	The learned order adapts as the access pattern changes: a resource is
+	guessed while the (exponentially weighted) fraction of recent
+	activations which got it is at least the confidence threshold.
+
+	This class uses the container's observers, so it is not thread-safe,
+	and `container::clear()` disables it.
+  */
+template <typename Scope>
+class speculation
+{
+public:
+	/// Counters of speculative instantiation
+	struct statistics {
+		size_t activations = 0;  //< activations recorded
+		size_t speculated = 0;   //< instances made speculatively
+		size_t claimed = 0;      //< speculative instances which were got
+		size_t wasted = 0;       //< speculative instances disposed unused
+		size_t failed = 0;       //< speculative instantiations that threw
+	};
+
+	/**
+		Start (or retune) speculation for the scope.
+
+		@param budget the maximum number of resources guessed per activation
+		@param confidence the fraction of recent activations in which a
+		       resource must have been got, to be guessed
+		@throws config_error if confidence is not in (0, 1]
+	  */
+	static void enable(size_t budget = 8, double confidence = 0.5)
+	{
+		if(!(confidence > 0.0 && confidence <= 1.0))
+			throw config_error(u::str_builder() << "Speculation confidence "
+				<< confidence << " is not in (0, 1]");
+		state& s = st();
+		container& p = providence();
+		if(! enabled()) {
+			s = state();
+			s.sub = p.observers().subscribe(mask, record);
+			s.epoch = p.epoch();
+			s.on = true;
+		}
+		s.budget = budget;
+		s.confidence = confidence;
+		guess();
+	}
+
+	/**
+		Stop speculation, and forget the recorded patterns.
+	  */
+	static void disable()
+	{
+		state& s = st();
+		if(enabled())
+			providence().observers().unsubscribe(s.sub);
+		s = state();
+		Scope::eager_resources().set_speculative({});
+	}
+
+	/** Return true if speculation is enabled */
+	static bool enabled() {
+		state& s = st();
+		return s.on && s.epoch==providence().epoch();
+	}
+
+	/** Return the counters of speculative instantiation */
+	static statistics stats() {
+		state& s = st();
+		statistics ret = s.counters;
+		auto es = Scope::eager_resources().stats();
+		ret.speculated = es.speculated - s.base.speculated;
+		ret.failed = es.failed - s.base.failed;
+		return ret;
+	}
+
+	/** Return the resources currently guessed, most likely first */
+	static const std::vector<resourceid>& guesses() {
+		return Scope::eager_resources().speculative();
+	}
+
+	/// The weight of the latest activation in the learned statistics
+	static constexpr double learning_rate = 0.25;
+
+private:
+	static constexpr unsigned mask = event_bit(Event::created) | event_bit(Event::claimed)
+		| scope_events;
+
+	// the first gets of an activation
+	struct frame {
+		std::vector<resourceid> seq;
+		std::unordered_set<const contextual_base*> seen;
+		size_t spec_base = 0;    // the speculated counter at activation
+		size_t nested_spec = 0;  // made speculatively by nested activations
+		size_t claims = 0;
+	};
+
+	// what is known of a resource
+	struct profile {
+		double frequency = 0;  // weighted fraction of activations which got it
+		double position = 0;   // weighted rank among the first gets
+	};
+
+	struct state {
+		bool on = false;
+		lifecycle_observers::subscription sub = 0;
+		size_t epoch = 0;
+		size_t budget = 0;
+		double confidence = 1;
+		std::vector<frame> frames;
+		resource_map<profile> profiles;
+		statistics counters;
+		eager_set::statistics base = Scope::eager_resources().stats();
+	};
+
+	static state& st() {
+		static state s;
+		return s;
+	}
+
+	// Called by the container's event delivery
+	static void record(const event_batch& batch)
+	{
+		state& s = st();
+		container& p = providence();
+		const std::type_index scope = typeid(Scope);
+		for(auto& ev : batch) {
+			if(ev.scope!=scope) continue;
+			switch(ev.kind) {
+			case Event::scope_activated:
+				s.frames.emplace_back();
+				s.frames.back().spec_base = Scope::eager_resources().stats().speculated;
+				break;
+			case Event::scope_deactivated:
+				if(! s.frames.empty()) learn(s);
+				break;
+			case Event::claimed:
+				if(! s.frames.empty()) ++ s.frames.back().claims;
+				++ s.counters.claimed;
+				[[fallthrough]];
+			case Event::created:
+				if(s.frames.empty() || (ev.kind==Event::created && p.speculating()))
+					break;
+				if(s.frames.back().seen.insert(ev.manager).second)
+					s.frames.back().seq.push_back(ev.manager->rid());
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	// Fold the innermost activation into the profiles
+	static void learn(state& s)
+	{
+		frame f = std::move(s.frames.back());
+		s.frames.pop_back();
+		++ s.counters.activations;
+
+		size_t made = Scope::eager_resources().stats().speculated - f.spec_base - f.nested_spec;
+		s.counters.wasted += made - std::min(made, f.claims);
+		if(! s.frames.empty())
+			s.frames.back().nested_spec += made + f.nested_spec;
+
+		for(auto iter = s.profiles.begin(); iter!=s.profiles.end(); ) {
+			iter->second.frequency *= 1 - learning_rate;
+			if(iter->second.frequency < 0.01)
+				iter = s.profiles.erase(iter);
+			else
+				++iter;
+		}
+		for(size_t i=0; i < f.seq.size(); ++i) {
+			auto [iter, isnew] = s.profiles.try_emplace(f.seq[i]);
+			profile& pr = iter->second;
+			if(isnew)
+				pr.position = i;
+			else
+				pr.position += learning_rate * (i - pr.position);
+			pr.frequency += learning_rate;
+		}
+		guess();
+	}
+
+	// Update the guesses of the eager set
+	static void guess()
+	{
+		state& s = st();
+		container& p = providence();
+		std::vector<std::pair<double, resourceid>> likely;
+		for(auto& [rid, pr] : s.profiles) {
+			if(pr.frequency < s.confidence - 1e-9) continue;
+			try {
+				if(! p.at(rid)->is_pure()) continue;
+			} catch(std::out_of_range&) {
+				continue;
+			}
+			likely.push_back({ pr.position, rid });
+		}
+		std::sort(likely.begin(), likely.end(), [](auto& a, auto& b) { return a.first < b.first; });
+		if(likely.size() > s.budget) likely.erase(likely.begin() + s.budget, likely.end());
+
+		std::vector<resourceid> rids;
+		for(auto& [pos, rid] : likely) rids.push_back(rid);
+		if(rids!=Scope::eager_resources().speculative())
+			Scope::eager_resources().set_speculative(std::move(rids));
+	}
+};
+
+
+} // end namespace cdi
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include "cdi.hh"
+#include "speculate.hh"
+
+using namespace cdi;
+using namespace std;
+
+class SpeculateSuite : public CxxTest::TestSuite
+{
+public:
+
+	struct ReqScope : LocalScope<ReqScope> { };
+	static inline qualifier Req { new scope_proxy<ReqScope> };
+
+	void tearDown() {
+		speculation<ReqScope>::disable();
+		ReqScope::eager_resources().clear();
+		providence().clear();
+	}
+
+	void test_speculation()
+	{
+		int made_a = 0, made_b = 0, made_c = 0;
+		resource<int> a({Req});
+		a.provide([&]() { return ++made_a; }).pure();
+		resource<string> b({Req});
+		b.provide([&](int x) { ++made_b; return to_string(x); }, a).pure();
+		resource<double> c({Req});
+		c.provide([&]() { return double(++made_c); });   // has side effects
+
+		TS_ASSERT_THROWS(speculation<ReqScope>::enable(4, 0.0), config_error);
+		speculation<ReqScope>::enable(4, 0.5);
+		TS_ASSERT(speculation<ReqScope>::enabled());
+
+		// learn the pattern
+		for(int i=0; i<3; ++i) {
+			ReqScope s;
+			c.get();
+			a.get();
+			b.get();
+		}
+		TS_ASSERT_EQUALS(made_a, 3);
+		vector<resourceid> expected { resourceid(a), resourceid(b) };
+		TS_ASSERT_EQUALS(speculation<ReqScope>::guesses(), expected);
+
+		// the pure resources are made on activation
+		{
+			ReqScope s;
+			TS_ASSERT_EQUALS(made_a, 4);
+			TS_ASSERT_EQUALS(made_b, 4);
+			TS_ASSERT_EQUALS(made_c, 3);
+			c.get();
+			a.get();
+			b.get();
+			TS_ASSERT_EQUALS(made_b, 4);
+		}
+		auto st = speculation<ReqScope>::stats();
+		TS_ASSERT_EQUALS(st.activations, 4);
+		TS_ASSERT_EQUALS(st.speculated, 2);
+		TS_ASSERT_EQUALS(st.claimed, 2);
+		TS_ASSERT_EQUALS(st.wasted, 0);
+
+		// unused guesses are wasted
+		{ ReqScope s; }
+		st = speculation<ReqScope>::stats();
+		TS_ASSERT_EQUALS(st.speculated, 4);
+		TS_ASSERT_EQUALS(st.wasted, 2);
+
+		// the budget bounds the guesses
+		speculation<ReqScope>::enable(1, 0.5);
+		TS_ASSERT_EQUALS(speculation<ReqScope>::guesses().size(), 1);
+
+		speculation<ReqScope>::disable();
+		TS_ASSERT(speculation<ReqScope>::guesses().empty());
+		{ ReqScope s; }
+		TS_ASSERT_EQUALS(made_a, 5);
+	}
+
+	void test_failed_speculation()
+	{
+		bool fail = false;
+		resource<int> a({Req});
+		a.provide([&]() -> int { if(fail) throw runtime_error("down"); return 1; }).pure();
+		speculation<ReqScope>::enable(4, 0.25);
+		{ ReqScope s; a.get(); }
+		TS_ASSERT_EQUALS(speculation<ReqScope>::guesses().size(), 1);
+
+		// failures are ignored, and retried by the get
+		fail = true;
+		{
+			ReqScope s;
+			fail = false;
+			TS_ASSERT_EQUALS(a.get(), 1);
+		}
+		TS_ASSERT_EQUALS(speculation<ReqScope>::stats().failed, 1);
+		TS_ASSERT_EQUALS(speculation<ReqScope>::stats().speculated, 0);
+	}
+};
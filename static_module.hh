@@ -0,0 +1,280 @@
+#pragma once
+
+#include <array>
+#include <tuple>
+#include <new>
+#include <utility>
+#include <type_traits>
+
+#include "container.hh"
+
+//=================================
+//
+//  static modules
+//
+//=================================
+
+namespace cdi {
+
+
+/// A list of types
+template <typename... Ts>
+struct typelist { };
+
+
+/**
+	The binding of a component in a `static_module`.
+
+	@tparam T the type of the component, stored by value in the module
+	@tparam Deps the components it is built from
+
+	By default, the component is constructed as `T(deps...)`, with lvalue
+	references to its dependencies. A different construction is given by
+	a binding which derives from this one and hides `make()`:
+	```
+	struct db_binding : binding<Database, Config> {
+		static Database make(Config& c) { return Database(c.url, c.pool_size); }
+	};
+	```
+	Since `make()` returns a prvalue, the component is constructed in place,
+	and it need not be movable.
+  */
+template <typename T, typename... Deps>
+struct binding
+{
+	typedef T type;
+	typedef typelist<Deps...> dependencies;
+
+	static T make(Deps&... deps) { return T(deps...); }
+};
+
+
+namespace detail {
+
+	// Return the position of T in Ts, or sizeof...(Ts)
+	template <typename T, typename... Ts>
+	constexpr size_t index_of()
+	{
+		constexpr bool same[] = { std::is_same_v<T, Ts>..., false };
+		for(size_t i=0; i < sizeof...(Ts); ++i)
+			if(same[i]) return i;
+		return sizeof...(Ts);
+	}
+
+	// Order the nodes of a graph so that dependencies come first,
+	// preferring the original order; returns the number placed, which is
+	// short of N on cycles
+	template <size_t N>
+	constexpr std::pair<std::array<size_t, N>, size_t>
+	topological_order(const std::array<std::array<bool, N>, N>& deps)
+	{
+		std::array<size_t, N> order {};
+		std::array<bool, N> placed {};
+		size_t n = 0;
+		while(n < N) {
+			size_t next = N;
+			for(size_t i=0; i < N && next==N; ++i) {
+				if(placed[i]) continue;
+				bool ready = true;
+				for(size_t j=0; j < N; ++j)
+					if(deps[i][j] && ! placed[j]) ready = false;
+				if(ready) next = i;
+			}
+			if(next==N) break;
+			placed[next] = true;
+			order[n++] = next;
+		}
+		return { order, n };
+	}
+
+	// The positions of Deps in Ts, as a row of an adjacency matrix
+	template <typename... Ts, typename... Deps>
+	constexpr std::array<bool, sizeof...(Ts)> dependency_row(typelist<Ts...>, typelist<Deps...>)
+	{
+		std::array<bool, sizeof...(Ts)> ret {};
+		constexpr size_t pos[] = { index_of<Deps, Ts...>()..., 0 };
+		for(size_t k=0; k < sizeof...(Deps); ++k)
+			if(pos[k] < sizeof...(Ts)) ret[pos[k]] = true;
+		return ret;
+	}
+
+	// Return true if all Deps are in Ts
+	template <typename... Ts, typename... Deps>
+	constexpr bool all_bound(typelist<Ts...>, typelist<Deps...>) {
+		return ((index_of<Deps, Ts...>() < sizeof...(Ts)) && ... && true);
+	}
+
+	// Return true if no type occurs twice in Ts
+	template <typename... Ts>
+	constexpr bool all_distinct(typelist<Ts...>) {
+		constexpr size_t first[] = { index_of<Ts, Ts...>()..., 0 };
+		for(size_t i=0; i < sizeof...(Ts); ++i)
+			if(first[i]!=i) return false;
+		return true;
+	}
+
+	/**
+		The dependency graph of a static module, analyzed at compile time.
+	  */
+	template <typename... Components>
+	struct module_graph
+	{
+		typedef typelist<typename Components::type...> types;
+
+		static constexpr size_t size = sizeof...(Components);
+
+		/// True if every dependency is bound by a component
+		static constexpr bool bound =
+			(all_bound(types(), typename Components::dependencies()) && ... && true);
+
+		/// True if no component type is bound twice
+		static constexpr bool unique = all_distinct(types());
+
+		/// deps[i][j] is true if component i depends on component j
+		static constexpr std::array<std::array<bool, size>, size> deps {
+			{ dependency_row(types(), typename Components::dependencies())... } };
+
+		/// True if there are no cyclical dependencies
+		static constexpr bool acyclic = topological_order(deps).second == size;
+
+		/// The construction order, as indices into the list of components
+		static constexpr std::array<size_t, size> order = topological_order(deps).first;
+	};
+
+
+	// Uninitialized storage for a component
+	template <typename T>
+	struct component_slot
+	{
+		template <typename Binding, typename... Deps>
+		inline void construct(Deps&... deps) { ::new (static_cast<void*>(buf)) T(Binding::make(deps...)); }
+
+		inline T& get() { return *std::launder(reinterpret_cast<T*>(buf)); }
+
+		inline void destroy() { get().~T(); }
+
+		alignas(T) unsigned char buf[sizeof(T)];
+	};
+}
+
+
+/**
+	A set of components wired at compile time.
+
+	@tparam Components the bindings of the components (see `binding`)
+
+	The module holds all components by value, in a fixed layout, and
+	constructs them in its constructor, in dependency order, by straight
+	line code: there are no resource lookups, no type erasure and no
+	allocations. Components are destroyed in the reverse order.
+	The bindings are checked at compile time: each dependency must be
+	bound, each type bound once, and there must be no cycles.
+	```
+	static_module<
+		binding<Server, Router, Database>,
+		binding<Router>,
+		binding<Database, Config>,
+		binding<Config>
+	> core;
+	core.get<Server>().run();
+	```
+	Components can be made available to the rest of the program as
+	ordinary resources, by `export_as()`.
+
+	A module is neither copyable nor movable, since components may hold
+	references to each other.
+  */
+template <typename... Components>
+class static_module
+{
+public:
+	/// The analysis of the bindings
+	typedef detail::module_graph<Components...> graph;
+
+	static_assert(graph::bound, "A dependency of a component is not bound in the module");
+	static_assert(graph::unique, "A component type is bound twice in the module");
+	static_assert(graph::acyclic, "Cyclical dependency among the components of the module");
+
+	/// The number of components
+	static constexpr size_t size = sizeof...(Components);
+
+	/**
+		Construct all components.
+
+		If a constructor throws, the components already constructed are
+		destroyed, and the exception is propagated.
+	  */
+	static_module() { construct(std::make_index_sequence<size>()); }
+
+	/** Destroy all components, dependents first */
+	~static_module() { destroy(std::make_index_sequence<size>()); }
+
+	static_module(const static_module&) = delete;
+	static_module& operator=(const static_module&) = delete;
+
+	/** Return a component */
+	template <typename T>
+	inline T& get() {
+		constexpr size_t i = detail::index_of<T, typename Components::type...>();
+		static_assert(i < size, "The type is not a component of the module");
+		return std::get<i>(slots).get();
+	}
+
+	/**
+		Declare a resource whose instance is a pointer to a component.
+
+		@tparam T the component type (by default, the pointee type of the
+		        resource)
+		@param r the resource, usually in `Global` scope
+		@return r
+
+		The module must outlive the instances of the resource.
+	  */
+	template <typename T = void, typename Instance>
+	const resource<Instance>& export_as(const resource<Instance>& r)
+	{
+		typedef std::conditional_t<std::is_void_v<T>,
+			std::remove_cv_t<std::remove_pointer_t<Instance>>, T> component_type;
+		static_assert(std::is_convertible_v<component_type*, Instance>,
+			"The resource cannot hold a pointer to the component");
+		r.provide([this]() -> Instance { return &get<component_type>(); });
+		return r;
+	}
+
+	/** Return the construction order, as indices into `Components` */
+	static constexpr const std::array<size_t, size>& construction_order() { return graph::order; }
+
+private:
+	template <size_t I>
+	using binding_at = std::tuple_element_t<I, std::tuple<Components...>>;
+
+	template <size_t I, typename... Deps>
+	void make(typelist<Deps...>) {
+		std::get<I>(slots).template construct<binding_at<I>>(get<Deps>()...);
+	}
+
+	template <size_t... K>
+	void construct(std::index_sequence<K...>)
+	{
+		try {
+			((make<graph::order[K]>(typename binding_at<graph::order[K]>::dependencies()), ++built), ...);
+		} catch(...) {
+			destroy(std::make_index_sequence<size>());
+			throw;
+		}
+	}
+
+	template <size_t... K>
+	void destroy(std::index_sequence<K...>)
+	{
+		// in the reverse order of construction, skipping the unbuilt
+		((size-1-K < built ? std::get<graph::order[size-1-K]>(slots).destroy() : void()), ...);
+		built = 0;
+	}
+
+	std::tuple<detail::component_slot<typename Components::type>...> slots;
+	size_t built = 0;
+};
+
+
+} // end namespace cdi
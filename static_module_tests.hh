@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cxxtest/TestSuite.h>
+
+#include <vector>
+#include <string>
+
+#include "cdi.hh"
+#include "static_module.hh"
+
+using namespace cdi;
+using namespace std;
+
+class StaticModuleSuite : public CxxTest::TestSuite
+{
+public:
+
+	static inline vector<string> log;
+
+	struct Config {
+		int port = 8080;
+		Config() { log.push_back("+config"); }
+		~Config() { log.push_back("-config"); }
+	};
+
+	struct Database {
+		Config& cfg;
+		Database(Config& c) : cfg(c) { log.push_back("+db"); }
+		Database(const Database&) = delete;
+		~Database() { log.push_back("-db"); }
+	};
+
+	struct Server {
+		Database& db;
+		int port;
+		Server(Database& d, int p) : db(d), port(p) { log.push_back("+server"); }
+		~Server() { log.push_back("-server"); }
+	};
+
+	struct server_binding : binding<Server, Database, Config> {
+		static Server make(Database& d, Config& c) { return Server(d, c.port+1); }
+	};
+
+	struct Broken {
+		Broken(Database&) { throw runtime_error("broken"); }
+	};
+
+	void setUp() { log.clear(); }
+
+	void tearDown() { providence().clear(); }
+
+	void test_construction_order()
+	{
+		typedef static_module<server_binding, binding<Database, Config>, binding<Config>> core_module;
+		array<size_t, 3> order { 2, 1, 0 };
+		TS_ASSERT(core_module::construction_order()==order);
+		{
+			core_module core;
+			vector<string> built { "+config", "+db", "+server" };
+			TS_ASSERT_EQUALS(log, built);
+			TS_ASSERT_EQUALS(&core.get<Server>().db, &core.get<Database>());
+			TS_ASSERT_EQUALS(&core.get<Database>().cfg, &core.get<Config>());
+			TS_ASSERT_EQUALS(core.get<Server>().port, 8081);
+		}
+		vector<string> all { "+config", "+db", "+server", "-server", "-db", "-config" };
+		TS_ASSERT_EQUALS(log, all);
+	}
+
+	void test_graph_checks()
+	{
+		struct A { }; struct B { }; struct C { };
+		typedef cdi::detail::module_graph<binding<A, B>, binding<B, A>> cyclic;
+		TS_ASSERT(! cyclic::acyclic);
+		typedef cdi::detail::module_graph<binding<A, C>> unbound;
+		TS_ASSERT(! unbound::bound);
+		typedef cdi::detail::module_graph<binding<A>, binding<A>> twice;
+		TS_ASSERT(! twice::unique);
+		typedef cdi::detail::module_graph<binding<A, B>, binding<B>> fine;
+		TS_ASSERT(fine::acyclic && fine::bound && fine::unique);
+	}
+
+	void test_failed_construction()
+	{
+		typedef static_module<binding<Config>, binding<Database, Config>, binding<Broken, Database>> broken_module;
+		TS_ASSERT_THROWS(broken_module(), runtime_error);
+		vector<string> expected { "+config", "+db", "-db", "-config" };
+		TS_ASSERT_EQUALS(log, expected);
+	}
+
+	void test_export()
+	{
+		static_module<binding<Config>, binding<Database, Config>> core;
+		resource<Database*> db({});
+		resource<const Config*> cfg({});
+		core.export_as(db);
+		core.export_as<Config>(cfg);
+
+		resource<int> port({});
+		port.provide([](const Config* c) { return c->port; }, cfg);
+		TS_ASSERT_EQUALS(db.get(), &core.get<Database>());
+		TS_ASSERT_EQUALS(port.get(), 8080);
+	}
+};
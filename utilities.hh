@@ -1,10 +1,16 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <functional>
+#include <typeindex>
+#include <type_traits>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <boost/core/demangle.hpp>
 #include <boost/functional/hash.hpp>
@@ -42,12 +48,208 @@ struct hash_code
 };
 
 
+/**
+	Scramble the bits of a hash value.
+
+	This is the finalizer of splitmix64 (murmur3's fmix32 on 32-bit
+	platforms). Every input bit affects every output bit, so hash values
+	that differ in a few (low) bits map to unrelated values.
+  */
+constexpr size_t mix_hash(size_t x)
+{
+	if constexpr (sizeof(size_t) >= 8) {
+		uint64_t z = x;
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return size_t(z ^ (z >> 31));
+	} else {
+		uint32_t z = uint32_t(x);
+		z = (z ^ (z >> 16)) * 0x85ebca6bU;
+		z = (z ^ (z >> 13)) * 0xc2b2ae35U;
+		return size_t(z ^ (z >> 16));
+	}
+}
+
+/**
+	Combine a hash value into a seed, in an order-dependent way.
+
+	Like `hash_combine`, but the result is passed through `mix_hash()`,
+	so that the seed is well-mixed even when `v` is a weak hash
+	(e.g., `std::hash<int>`, which is the identity).
+  */
+constexpr void combine_hash(size_t& seed, size_t v)
+{
+	seed = mix_hash(seed ^ (v + size_t(0x9e3779b97f4a7c15ULL) + (seed<<6) + (seed>>2)));
+}
+
+/**
+	Return a refcount-free pointer to the object owned by a shared pointer.
+
+	@param p a shared pointer
+	@return a shared pointer to the same object, without a control block
+
+	The returned pointer is an aliasing `std::shared_ptr` with an empty owner,
+	so copying and destroying it never writes to memory. The object is kept
+	alive forever, by an owner stored in a registry that is never touched again.
+	Pointers that are already refcount-free are returned as they are.
+
+	This is used to keep memory pages shared with forked processes clean.
+  */
+template <typename T>
+std::shared_ptr<T> make_immortal(const std::shared_ptr<T>& p)
+{
+	if(p.get()==nullptr || p.use_count()==0)
+		return p;
+	// leaked on purpose: the objects must outlive all static destructors
+	static auto* owners = new std::vector< std::shared_ptr<const void> >();
+	owners->push_back(p);
+	return std::shared_ptr<T>(std::shared_ptr<T>(), p.get());
+}
+
+
+/// A dense integer id for a C++ type
+typedef uint32_t type_id;
+
+/**
+	Type ids with this bit set are computed at compile time.
+	@see static_type_id()
+  */
+constexpr type_id static_type_ids = type_id(1) << 31;
+
+/**
+	Return a compile-time id for a type.
+
+	The id is a 31-bit FNV-1a hash of the name of the type (taken from the
+	signature of this function), with bit `static_type_ids` set, so it
+	does not coincide with the ids of the registry. Distinct types may
+	collide; users of static ids must also compare the types themselves
+	when two static ids are equal.
+  */
+template <typename T>
+constexpr type_id static_type_id()
+{
+	uint32_t h = 2166136261u;
+	for(const char* p = __PRETTY_FUNCTION__; *p; ++p) {
+		h ^= uint8_t(*p);
+		h *= 16777619u;
+	}
+	return h | static_type_ids;
+}
+
+/**
+	True for types that have a static type id.
+
+	A type opts in by declaring a member `typedef void static_id_tag;`
+	(which is inherited).
+  */
+template <typename T, class = std::void_t<> >
+struct has_static_id : std::false_type { };
+
+template <typename T>
+struct has_static_id<T, std::void_t<typename T::static_id_tag> > : std::true_type { };
+
+namespace detail {
+	struct type_registry {
+		std::mutex mutex;
+		std::unordered_map<std::type_index, type_id> ids;
+		std::vector<std::type_index> types;
+	};
+
+	// leaked on purpose: ids must remain valid during static destruction
+	inline type_registry& types() {
+		static auto* reg = new type_registry();
+		return *reg;
+	}
+}
+
+/**
+	Return the dense id of a type, assigning one if needed.
+
+	@param ti the type index of the type
+	@return the id of the type
+
+	Ids are assigned in order of first use, starting from 0, so that they
+	can index tables directly. The same type always gets the same id,
+	in a process. This takes a lock; prefer `type_id_of()` when the type
+	is known at compile time. For types with a static id, `type_id_of()`
+	returns the static id, not this one.
+  */
+inline type_id type_id_for(const std::type_index& ti)
+{
+	auto& reg = detail::types();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	auto [iter, added] = reg.ids.try_emplace(ti, type_id(reg.types.size()));
+	if(added) reg.types.push_back(ti);
+	assert(iter->second < static_type_ids);
+	return iter->second;
+}
+
+/**
+	Return the registry id of a type.
+
+	The registry is consulted once per type; later calls only read a
+	static variable.
+  */
+template <typename T>
+inline type_id registered_type_id()
+{
+	static const type_id id = type_id_for(typeid(T));
+	return id;
+}
+
+/**
+	Return the id of a type.
+
+	@tparam T the type
+	@return the id of the type
+
+	For types with a static id (see `has_static_id`) this is a constant
+	expression; for other types it is `registered_type_id<T>()`.
+  */
+template <typename T>
+constexpr type_id type_id_of()
+{
+	if constexpr (has_static_id<T>::value)
+		return static_type_id<T>();
+	else
+		return registered_type_id<T>();
+}
+
+/**
+	Return the type index of a type id, for diagnostics.
+	@param id a type id returned by `type_id_for()` (not a static id)
+  */
+inline std::type_index type_of(type_id id)
+{
+	auto& reg = detail::types();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	assert(id < reg.types.size());
+	return reg.types[id];
+}
+
+/// Return the number of types that have been assigned an id
+inline size_t registered_types()
+{
+	auto& reg = detail::types();
+	std::lock_guard<std::mutex> lock(reg.mutex);
+	return reg.types.size();
+}
+
+
+/// A mutex type that does nothing, for single-threaded use
+struct null_mutex {
+	inline void lock() { }
+	inline void unlock() { }
+};
+
 /**
 	A storage provider for unique objects.
 
 	@tparam StoredType the type of objects to store
 	@tparam Hash a function class for hashing type `StoredType`
 	@tparam Equal a function class for equivalence of objects of type `StoredType`
+	@tparam Mutex a mutex type guarding the storage; with `std::mutex`, objects
+	        can be allocated and released from any thread
 
 	Instances of this class can be used to allocate "unique" instances of `StoredType`
 	objects. Uniqueness is defined by an eqivalence function and a compatible hash function.
@@ -63,7 +265,8 @@ struct hash_code
 
 	The main API method is `allocate(args...)`. 
  */
-template <typename StoredType, typename Hash = std::hash<StoredType>, typename Equal = std::equal_to<StoredType> >
+template <typename StoredType, typename Hash = std::hash<StoredType>,
+	typename Equal = std::equal_to<StoredType>, typename Mutex = null_mutex >
 struct unique_storage
 {
 	/// The stored object type
@@ -85,6 +288,7 @@ struct unique_storage
 	template <typename ... Args>
 	shared_pointer allocate(Args&& ... args) 
 	{
+		std::lock_guard<Mutex> lock(mutex);
 		auto ins = storage.emplace(std::forward<Args>(args)...);
 		if(ins.second) {
 			// item was inserted
@@ -95,17 +299,25 @@ struct unique_storage
 			return sptr;
 		} else {
 			// item existed!
-			std::weak_ptr<StoredType>& wptr = (* ins.first).wptr;
-			assert(! wptr.expired());
-			return wptr.lock();
+			shared_pointer sptr = (* ins.first).wptr.lock();
+			if(! sptr) {
+				// it is being released by another thread, which waits for
+				// the lock to free it; return an unshared copy
+				sptr = std::make_shared<StoredType>((* ins.first).object);
+			}
+			return sptr;
 		}
 	}
 
-	inline size_t size() const { return storage.size(); }
+	inline size_t size() const {
+		std::lock_guard<Mutex> lock(mutex);
+		return storage.size();
+	}
 
 private:
 	void free(StoredType* ptr)
 	{
+		std::lock_guard<Mutex> lock(mutex);
 		// find it 
 		auto it = storage.find(*ptr);
 		assert(it != storage.end());
@@ -146,6 +358,7 @@ private:
 	friend struct Deleter;
 
 	std::unordered_set<value_type, hasher, equal_to> storage;
+	mutable Mutex mutex;
 
 };
 